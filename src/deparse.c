@@ -0,0 +1,1654 @@
+/*------------------------------------------------------------------
+*
+*				Foreign data wrapper for TDS (Sybase and Microsoft SQL Server)
+*
+* Author: Geoff Montee
+* Name: tds_fdw
+* File: tds_fdw/src/deparse.c
+*
+* Description:
+* This file contains the functions that build the SQL statements sent to the
+* foreign server.
+*----------------------------------------------------------------------------
+*/
+
+#include "postgres.h"
+
+#include <ctype.h>
+#include <math.h>
+
+#include "access/transam.h"
+#include "catalog/pg_type.h"
+#include "lib/stringinfo.h"
+#include "nodes/nodeFuncs.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+#include "utils/date.h"
+#include "utils/datetime.h"
+#include "utils/lsyscache.h"
+#include "utils/rel.h"
+#include "utils/timestamp.h"
+
+#include "tds_fdw.h"
+
+/*#define DEBUG*/
+
+/* context for checking whether an expression can be sent to the foreign server */
+
+typedef struct TdsForeignExprContext
+{
+	RelOptInfo *baserel;
+	const TdsFdwDialect *dialect;
+	bool superset;
+} TdsForeignExprContext;
+
+/* context for deparsing an expression */
+
+typedef struct TdsDeparseContext
+{
+	StringInfo buf;
+	Relation rel;
+	TdsFdwOptionSet *option_set;
+	bool national;
+	const TdsFdwDialect *dialect;
+	Index relid;
+	List *remote_params;
+	List *staged_params;
+} TdsDeparseContext;
+
+/* context for finding the parameters of expressions */
+
+typedef struct TdsRemoteParamsContext
+{
+	Index relid;
+	List *params;
+} TdsRemoteParamsContext;
+
+static bool tdsForeignExprWalker(Node *node, TdsForeignExprContext *context);
+static bool tdsIsPushableConst(Const *node);
+static bool tdsIsPushableOperator(Oid opno, bool is_text);
+static void tdsDeparseExpr(Expr *node, TdsDeparseContext *context, bool is_condition);
+static void tdsDeparseConst(Const *node, TdsDeparseContext *context, bool is_condition);
+static void tdsDeparseDatum(Datum value, Oid typid, TdsDeparseContext *context);
+static void tdsDeparseColumnRef(int attnum, TdsDeparseContext *context);
+static char* tdsReplacePlaceholders(const char *query);
+static bool tdsGetRemoteParamsWalker(Node *node, TdsRemoteParamsContext *context);
+static bool tdsIsParamType(Oid typid, const TdsFdwDialect *dialect);
+static bool tdsIsPushableArray(Const *node);
+static int tdsGetParamIndex(Node *node, TdsDeparseContext *context);
+static void tdsDeparseParamRef(Node *node, TdsDeparseContext *context, bool is_condition);
+
+/* quote an identifier for the remote server, e.g. my]col becomes [my]]col] */
+
+void tdsQuoteIdentifier(StringInfo buf, const char *ident)
+{
+	const char *ch;
+
+	appendStringInfoChar(buf, '[');
+
+	for (ch = ident; *ch; ch++)
+	{
+		if (*ch == ']')
+			appendStringInfoChar(buf, ']');
+
+		appendStringInfoChar(buf, *ch);
+	}
+
+	appendStringInfoChar(buf, ']');
+}
+
+/* can a local column of this type receive the output of COMPRESS()? */
+
+bool tdsIsCompressibleType(Oid typid)
+{
+	switch (typid)
+	{
+		case TEXTOID:
+		case VARCHAROID:
+		case BPCHAROID:
+		case BYTEAOID:
+			return true;
+		default:
+			return false;
+	}
+}
+
+/* can values of this type be compared on the foreign server? */
+
+bool tdsIsPushableType(Oid typid)
+{
+	switch (typid)
+	{
+		case BOOLOID:
+		case INT2OID:
+		case INT4OID:
+		case INT8OID:
+		case FLOAT4OID:
+		case FLOAT8OID:
+		case NUMERICOID:
+		case DATEOID:
+		case TIMESTAMPOID:
+		case TEXTOID:
+		case VARCHAROID:
+		case BPCHAROID:
+			return true;
+		default:
+			return false;
+	}
+}
+
+/*
+ * Types that can be compared with each other on the foreign server. Comparing a
+ * date with a timestamp would convert the timestamp to a date there, so these
+ * are kept apart.
+ */
+
+static char tdsGetTypeClass(Oid typid)
+{
+	switch (typid)
+	{
+		case BOOLOID:
+			return 'b';
+		case INT2OID:
+		case INT4OID:
+		case INT8OID:
+		case FLOAT4OID:
+		case FLOAT8OID:
+		case NUMERICOID:
+			return 'n';
+		case DATEOID:
+			return 'd';
+		case TIMESTAMPOID:
+			return 't';
+		case TEXTOID:
+		case VARCHAROID:
+		case BPCHAROID:
+			return 's';
+		default:
+			return '\0';
+	}
+}
+
+/* does this type compare differently on the foreign server, because of collations? */
+
+bool tdsIsTextType(Oid typid)
+{
+	return typid == TEXTOID || typid == VARCHAROID || typid == BPCHAROID;
+}
+
+/*
+ * Can the expression be evaluated on the foreign server?
+ *
+ * The server's collation usually ignores case and trailing spaces, so equality
+ * on text finds every row that would match locally, and maybe a few more. Those
+ * conditions are still sent, but recheck is set so they are also checked locally.
+ */
+
+bool tdsIsForeignExpr(RelOptInfo *baserel, Expr *expr, bool *recheck)
+{
+	TdsForeignExprContext context;
+
+	context.baserel = baserel;
+	context.dialect = &((TdsFdwRelationInfo *) baserel->fdw_private)->option_set.dialect;
+	context.superset = false;
+
+	if (!tdsForeignExprWalker((Node *) expr, &context))
+		return false;
+
+	*recheck = context.superset;
+
+	return true;
+}
+
+static bool tdsForeignExprWalker(Node *node, TdsForeignExprContext *context)
+{
+	if (node == NULL)
+		return true;
+
+	switch (nodeTag(node))
+	{
+		case T_Var:
+		{
+			Var *var = (Var *) node;
+
+			if (var->varlevelsup != 0)
+				return false;
+
+			/* a column of another relation is sent as a parameter, for lookups in a nested loop */
+			if (var->varno != context->baserel->relid)
+				return tdsIsParamType(var->vartype, context->dialect);
+
+			if (var->varattno <= 0)
+				return false;
+
+			if (!tdsIsPushableType(var->vartype))
+				return false;
+
+			if (tdsIsTextType(var->vartype))
+				context->superset = true;
+
+			return true;
+		}
+
+		case T_Const:
+			return tdsIsPushableConst((Const *) node);
+
+		case T_Param:
+		{
+			Param *param = (Param *) node;
+
+			if (param->paramkind != PARAM_EXTERN && param->paramkind != PARAM_EXEC)
+				return false;
+
+			return tdsIsParamType(param->paramtype, context->dialect);
+		}
+
+		case T_RelabelType:
+		{
+			RelabelType *relabel = (RelabelType *) node;
+
+			/* only binary-compatible casts between types that we know about */
+			if (!tdsIsPushableType(relabel->resulttype))
+				return false;
+
+			return tdsForeignExprWalker((Node *) relabel->arg, context);
+		}
+
+		case T_OpExpr:
+		{
+			OpExpr *op = (OpExpr *) node;
+			bool is_text = false;
+			ListCell *lc;
+
+			if (list_length(op->args) != 2)
+				return false;
+
+			if (tdsGetTypeClass(exprType(linitial(op->args))) != tdsGetTypeClass(exprType(lsecond(op->args))))
+				return false;
+
+			foreach (lc, op->args)
+			{
+				if (tdsIsTextType(exprType((Node *) lfirst(lc))))
+					is_text = true;
+			}
+
+			if (!tdsIsPushableOperator(op->opno, is_text))
+				return false;
+
+			foreach (lc, op->args)
+			{
+				if (!tdsForeignExprWalker((Node *) lfirst(lc), context))
+					return false;
+			}
+
+			return true;
+		}
+
+		case T_ScalarArrayOpExpr:
+		{
+			ScalarArrayOpExpr *saop = (ScalarArrayOpExpr *) node;
+			Node *left = (Node *) linitial(saop->args);
+			Node *right = (Node *) lsecond(saop->args);
+			char *opname;
+			bool is_equality;
+
+			if (!saop->useOr || saop->opno >= FirstBootstrapObjectId)
+				return false;
+
+			opname = get_opname(saop->opno);
+			is_equality = (opname && strcmp(opname, "=") == 0);
+
+			if (!is_equality)
+				return false;
+
+			/*
+			 * col = ANY (array parameter), e.g. from ARRAY(SELECT ...), is sent as
+			 * the range of the values of the array, and checked locally. The range
+			 * of text would depend on the collation.
+			 */
+			if (IsA(right, Param))
+			{
+				Param *param = (Param *) right;
+				Oid element_type = get_element_type(param->paramtype);
+
+				if (param->paramkind != PARAM_EXTERN && param->paramkind != PARAM_EXEC)
+					return false;
+
+				if (!tdsIsParamType(element_type, context->dialect) || tdsIsTextType(element_type) || element_type == BOOLOID)
+					return false;
+
+				if (!IsA(left, Var) || ((Var *) left)->varno != context->baserel->relid)
+					return false;
+
+				if (tdsGetTypeClass(exprType(left)) != tdsGetTypeClass(element_type))
+					return false;
+
+				context->superset = true;
+
+				return tdsForeignExprWalker(left, context);
+			}
+
+			/* col = ANY (array), which becomes col IN (...) */
+			if (!IsA(right, Const) || ((Const *) right)->constisnull)
+				return false;
+
+			if (!tdsIsPushableType(get_element_type(((Const *) right)->consttype)))
+				return false;
+
+			if (tdsGetTypeClass(exprType(left)) != tdsGetTypeClass(get_element_type(((Const *) right)->consttype)))
+				return false;
+
+			if (!tdsIsPushableArray((Const *) right))
+				return false;
+
+			return tdsForeignExprWalker(left, context);
+		}
+
+		case T_BoolExpr:
+		{
+			BoolExpr *b = (BoolExpr *) node;
+			ListCell *lc;
+
+			/* a condition that only finds a superset of the rows can't be negated */
+			foreach (lc, b->args)
+			{
+				TdsForeignExprContext arg_context = *context;
+
+				arg_context.superset = false;
+
+				if (!tdsForeignExprWalker((Node *) lfirst(lc), &arg_context))
+					return false;
+
+				if (arg_context.superset && b->boolop == NOT_EXPR)
+					return false;
+
+				context->superset = context->superset || arg_context.superset;
+			}
+
+			return true;
+		}
+
+		case T_NullTest:
+		{
+			NullTest *nt = (NullTest *) node;
+
+			if (nt->argisrow || !IsA(nt->arg, Var))
+				return false;
+
+			return tdsForeignExprWalker((Node *) nt->arg, context);
+		}
+
+		default:
+			return false;
+	}
+}
+
+/* check that every element of an array constant can be written as a literal */
+
+static bool tdsIsPushableArray(Const *node)
+{
+	ArrayType *array = DatumGetArrayTypeP(node->constvalue);
+	Oid element_type = ARR_ELEMTYPE(array);
+	int16 typlen;
+	bool typbyval;
+	char typalign;
+	Datum *elements;
+	bool *nulls;
+	int nelements;
+	int i;
+
+	get_typlenbyvalalign(element_type, &typlen, &typbyval, &typalign);
+	deconstruct_array(array, element_type, typlen, typbyval, typalign,
+		&elements, &nulls, &nelements);
+
+	for (i = 0; i < nelements; i++)
+	{
+		if (!nulls[i] && !tdsIsPushableValue(elements[i], element_type))
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * can values of this type be sent as parameters of sp_executesql? NaN and
+ * infinity can't be.
+ */
+
+static bool tdsIsParamType(Oid typid, const TdsFdwDialect *dialect)
+{
+	if (typid == FLOAT4OID || typid == FLOAT8OID)
+		return false;
+
+	if (!tdsDialectHasParameters(dialect))
+		return false;
+
+	return tdsIsPushableType(typid) && tdsGetParameterType(typid, dialect) != NULL;
+}
+
+/* comparison operators are the only ones that behave the same remotely */
+
+static bool tdsIsPushableOperator(Oid opno, bool is_text)
+{
+	char *opname;
+	bool pushable;
+
+	/* user-defined operators could do anything */
+	if (opno >= FirstBootstrapObjectId)
+		return false;
+
+	if ((opname = get_opname(opno)) == NULL)
+		return false;
+
+	if (is_text)
+		pushable = (strcmp(opname, "=") == 0);
+	else
+		pushable = (strcmp(opname, "=") == 0 || strcmp(opname, "<>") == 0 ||
+			strcmp(opname, "<") == 0 || strcmp(opname, "<=") == 0 ||
+			strcmp(opname, ">") == 0 || strcmp(opname, ">=") == 0);
+
+	pfree(opname);
+
+	return pushable;
+}
+
+/* check that the value of a constant can be written as a literal for the foreign server */
+
+static bool tdsIsPushableConst(Const *node)
+{
+	if (!tdsIsPushableType(node->consttype))
+		return false;
+
+	if (node->constisnull)
+		return true;
+
+	return tdsIsPushableValue(node->constvalue, node->consttype);
+}
+
+/* check that a value can be written as a literal without losing anything */
+
+bool tdsIsPushableValue(Datum value, Oid typid)
+{
+	switch (typid)
+	{
+		case FLOAT4OID:
+		{
+			float4 fvalue = DatumGetFloat4(value);
+
+			return !isnan(fvalue) && !isinf(fvalue);
+		}
+
+		case FLOAT8OID:
+		{
+			float8 fvalue = DatumGetFloat8(value);
+
+			return !isnan(fvalue) && !isinf(fvalue);
+		}
+
+		case NUMERICOID:
+		{
+			char *str = DatumGetCString(DirectFunctionCall1(numeric_out, value));
+			bool pushable = (strcmp(str, "NaN") != 0);
+
+			pfree(str);
+
+			return pushable;
+		}
+
+		case DATEOID:
+		{
+			DateADT date = DatumGetDateADT(value);
+			int year, month, day;
+
+			if (DATE_NOT_FINITE(date))
+				return false;
+
+			j2date(date + POSTGRES_EPOCH_JDATE, &year, &month, &day);
+
+			return year >= 1 && year <= 9999;
+		}
+
+		case TIMESTAMPOID:
+		{
+			#ifdef HAVE_INT64_TIMESTAMP
+				Timestamp timestamp = DatumGetTimestamp(value);
+				struct pg_tm tm;
+				fsec_t fsec;
+
+				if (TIMESTAMP_NOT_FINITE(timestamp))
+					return false;
+
+				if (timestamp2tm(timestamp, NULL, &tm, &fsec, NULL, NULL) != 0)
+					return false;
+
+				/*
+				 * The literal is converted to datetime when it is compared to a
+				 * datetime column, which rounds to 1/300 of a second. Only whole
+				 * hundredths of a second land exactly on one of those.
+				 */
+				return tm.tm_year >= 1753 && tm.tm_year <= 9999 && fsec % 10000 == 0;
+			#else
+				return false;
+			#endif
+		}
+
+		default:
+			return true;
+	}
+}
+
+/* is the server at least this major version of SQL Server, or maybe newer? */
+
+static bool tdsIsSqlServerVersion(const TdsFdwDialect *dialect, int major_version)
+{
+	if (!dialect)
+		return true;
+
+	if (dialect->product == TDS_PRODUCT_SYBASE)
+		return false;
+
+	return dialect->major_version == 0 || dialect->major_version >= major_version;
+}
+
+/* is the server at least this major version of Sybase ASE? */
+
+static bool tdsIsSybaseVersion(const TdsFdwDialect *dialect, int major_version)
+{
+	if (!dialect || dialect->product != TDS_PRODUCT_SYBASE)
+		return false;
+
+	return dialect->major_version == 0 || dialect->major_version >= major_version;
+}
+
+/*
+ * does the server understand SELECT TOP n? Sybase ASE added it in 12.5.3, but
+ * only major versions are compared.
+ */
+
+bool tdsDialectHasTop(const TdsFdwDialect *dialect)
+{
+	return tdsIsSqlServerVersion(dialect, 0) || tdsIsSybaseVersion(dialect, 15);
+}
+
+/* does the server have COMPRESS()? It was added in SQL Server 2016. */
+
+bool tdsDialectHasCompress(const TdsFdwDialect *dialect)
+{
+	return tdsIsSqlServerVersion(dialect, 13);
+}
+
+/* does the server have sp_executesql and sp_prepare? Sybase ASE doesn't. */
+
+bool tdsDialectHasParameters(const TdsFdwDialect *dialect)
+{
+	return tdsIsSqlServerVersion(dialect, 0);
+}
+
+/*
+ * get the type of a parameter for a local type, or NULL. A NULL dialect means
+ * the newest version of SQL Server. Sybase ASE gets the types of variables
+ * that are declared in a batch, since it has no sp_executesql.
+ */
+
+const char* tdsGetParameterType(Oid typid, const TdsFdwDialect *dialect)
+{
+	switch (typid)
+	{
+		case BOOLOID:
+			return "bit";
+		case INT2OID:
+			return "smallint";
+		case INT4OID:
+			return "int";
+		case INT8OID:
+			if (tdsIsSybaseVersion(dialect, 15) || tdsIsSqlServerVersion(dialect, 0))
+				return "bigint";
+			return NULL;
+		case FLOAT4OID:
+			return "real";
+		case FLOAT8OID:
+			return "float";
+		/* every date fits in a datetime, but not every timestamp */
+		case DATEOID:
+			if (tdsIsSqlServerVersion(dialect, 10) || tdsIsSybaseVersion(dialect, 15))
+				return "date";
+			return "datetime";
+		case TIMESTAMPOID:
+			if (tdsIsSqlServerVersion(dialect, 10))
+				return "datetime2";
+			if (tdsIsSybaseVersion(dialect, 16))
+				return "bigdatetime";
+			return NULL;
+		case TEXTOID:
+		case VARCHAROID:
+		case BPCHAROID:
+			if (tdsIsSqlServerVersion(dialect, 9))
+				return "nvarchar(max)";
+			if (tdsIsSybaseVersion(dialect, 0))
+				return "varchar(16384)";
+			return "nvarchar(4000)";
+		default:
+			return NULL;
+	}
+}
+
+/* check that a value can be given to a parameter of sp_executesql */
+
+bool tdsIsParameterValue(Datum value, Oid typid)
+{
+	switch (typid)
+	{
+		case FLOAT4OID:
+		case FLOAT8OID:
+			return tdsIsPushableValue(value, typid);
+
+		case DATEOID:
+		{
+			DateADT date = DatumGetDateADT(value);
+			int year, month, day;
+
+			if (DATE_NOT_FINITE(date))
+				return false;
+
+			j2date(date + POSTGRES_EPOCH_JDATE, &year, &month, &day);
+
+			return year >= 1 && year <= 9999;
+		}
+
+		/* datetime2 has the range and precision of a timestamp */
+		case TIMESTAMPOID:
+		{
+			Timestamp timestamp = DatumGetTimestamp(value);
+			struct pg_tm tm;
+			fsec_t fsec;
+
+			if (TIMESTAMP_NOT_FINITE(timestamp))
+				return false;
+
+			if (timestamp2tm(timestamp, NULL, &tm, &fsec, NULL, NULL) != 0)
+				return false;
+
+			return tm.tm_year >= 1 && tm.tm_year <= 9999;
+		}
+
+		default:
+			return true;
+	}
+}
+
+/*
+ * Get a value as a string for a parameter of sp_executesql. This is only used
+ * for the types that are not sent in binary.
+ */
+
+char* tdsGetParameterString(Datum value, Oid typid)
+{
+	StringInfoData buf;
+
+	initStringInfo(&buf);
+
+	switch (typid)
+	{
+		case DATEOID:
+		{
+			int year, month, day;
+
+			j2date(DatumGetDateADT(value) + POSTGRES_EPOCH_JDATE, &year, &month, &day);
+			appendStringInfo(&buf, "%04d%02d%02d", year, month, day);
+			break;
+		}
+
+		case TIMESTAMPOID:
+		{
+			struct pg_tm tm;
+			fsec_t fsec;
+
+			timestamp2tm(DatumGetTimestamp(value), NULL, &tm, &fsec, NULL, NULL);
+
+			appendStringInfo(&buf, "%04d-%02d-%02dT%02d:%02d:%02d",
+				tm.tm_year, tm.tm_mon, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec);
+
+			#ifdef HAVE_INT64_TIMESTAMP
+				appendStringInfo(&buf, ".%06d", (int) fsec);
+			#else
+				appendStringInfo(&buf, ".%06d", (int) rint(fsec * 1000000.0));
+			#endif
+
+			break;
+		}
+
+		case TEXTOID:
+		case VARCHAROID:
+		case BPCHAROID:
+		{
+			char *str = TextDatumGetCString(value);
+
+			appendStringInfoString(&buf, str);
+			pfree(str);
+			break;
+		}
+
+		default:
+		{
+			Oid typoutput;
+			bool typisvarlena;
+
+			getTypeOutputInfo(typid, &typoutput, &typisvarlena);
+			appendStringInfoString(&buf, OidOutputFunctionCall(typoutput, value));
+			break;
+		}
+	}
+
+	return buf.data;
+}
+
+/* get the declarations of the parameters for sp_executesql, e.g. @a int, @b date */
+
+char* tdsGetParameterDeclarations(TdsFdwParameter *params, int nparams, const TdsFdwDialect *dialect)
+{
+	StringInfoData buf;
+	int i;
+
+	initStringInfo(&buf);
+
+	for (i = 0; i < nparams; i++)
+	{
+		appendStringInfo(&buf, "%s@%s %s", i > 0 ? ", " : "", params[i].name,
+			tdsGetParameterType(params[i].typid, dialect));
+	}
+
+	return buf.data;
+}
+
+/*
+ * Get the parameters used by expressions, without duplicates. These are
+ * parameters of the local query, and columns of relations other than relid.
+ */
+
+List* tdsGetRemoteParams(List *exprs, Index relid)
+{
+	TdsRemoteParamsContext context;
+
+	context.relid = relid;
+	context.params = NIL;
+
+	tdsGetRemoteParamsWalker((Node *) exprs, &context);
+
+	return context.params;
+}
+
+static bool tdsGetRemoteParamsWalker(Node *node, TdsRemoteParamsContext *context)
+{
+	if (node == NULL)
+		return false;
+
+	if (IsA(node, Param) || (IsA(node, Var) && ((Var *) node)->varno != context->relid))
+	{
+		if (!list_member(context->params, node))
+			context->params = lappend(context->params, node);
+
+		return false;
+	}
+
+	return expression_tree_walker(node, tdsGetRemoteParamsWalker, (void *) context);
+}
+
+/*
+ * Can a value of value_type be given to the parameter of a placeholder that is
+ * bound to a column of column_type? Any integer fits an integer parameter, but
+ * other numbers would be rounded, so they must have the same type.
+ */
+
+bool tdsIsPlaceholderType(Oid column_type, Oid value_type)
+{
+	if (!tdsGetParameterType(column_type, NULL) || !tdsGetParameterType(value_type, NULL))
+		return false;
+
+	if (tdsGetTypeClass(column_type) != tdsGetTypeClass(value_type))
+		return false;
+
+	if (column_type == FLOAT4OID || column_type == FLOAT8OID ||
+		value_type == FLOAT4OID || value_type == FLOAT8OID)
+		return column_type == value_type;
+
+	return true;
+}
+
+/* is this a valid name for a placeholder, and so for a T-SQL variable? */
+
+bool tdsIsPlaceholderName(const char *name)
+{
+	const char *ch;
+
+	if (!name[0] || isdigit((unsigned char) name[0]))
+		return false;
+
+	for (ch = name; *ch; ch++)
+	{
+		if (!isalnum((unsigned char) *ch) && *ch != '_')
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * Find the length of the placeholder at the start of str, e.g. 9 for
+ * {{a_b}}, or 0 if there is none there.
+ */
+
+static int tdsGetPlaceholderLength(const char *str)
+{
+	int len;
+
+	if (strncmp(str, "{{", 2) != 0)
+		return 0;
+
+	for (len = 2; isalnum((unsigned char) str[len]) || str[len] == '_'; len++)
+		;
+
+	if (len == 2 || isdigit((unsigned char) str[2]) || strncmp(str + len, "}}", 2) != 0)
+		return 0;
+
+	return len + 2;
+}
+
+/* get the names of the placeholders in a query, without duplicates */
+
+List* tdsGetPlaceholderNames(const char *query)
+{
+	List *names = NIL;
+	const char *ch;
+
+	for (ch = query; *ch; ch++)
+	{
+		int len = tdsGetPlaceholderLength(ch);
+		char *name;
+		ListCell *lc;
+		bool found = false;
+
+		if (len == 0)
+			continue;
+
+		name = pnstrdup(ch + 2, len - 4);
+
+		foreach (lc, names)
+		{
+			if (strcmp((char *) lfirst(lc), name) == 0)
+				found = true;
+		}
+
+		if (!found)
+			names = lappend(names, name);
+
+		ch += len - 1;
+	}
+
+	return names;
+}
+
+/* replace each placeholder, e.g. {{tenant_id}}, with its parameter, @tenant_id */
+
+static char* tdsReplacePlaceholders(const char *query)
+{
+	StringInfoData buf;
+	const char *ch;
+
+	initStringInfo(&buf);
+
+	for (ch = query; *ch; ch++)
+	{
+		int len = tdsGetPlaceholderLength(ch);
+
+		if (len == 0)
+		{
+			appendStringInfoChar(&buf, *ch);
+			continue;
+		}
+
+		appendStringInfoChar(&buf, '@');
+		appendBinaryStringInfo(&buf, ch + 2, len - 4);
+		ch += len - 1;
+	}
+
+	return buf.data;
+}
+
+/* get the remote name of a column */
+
+const char* tdsGetColumnName(Relation rel, TdsFdwOptionSet* option_set, int attnum)
+{
+	TdsFdwColumnOption *column = &option_set->columns[attnum - 1];
+
+	if (column->column_name)
+		return column->column_name;
+
+	return NameStr(RelationGetDescr(rel)->attrs[attnum - 1]->attname);
+}
+
+static void tdsDeparseColumnRef(int attnum, TdsDeparseContext *context)
+{
+	tdsQuoteIdentifier(context->buf, tdsGetColumnName(context->rel, context->option_set, attnum));
+}
+
+/*
+ * Deparse an expression. If is_condition is set, the expression is used as a
+ * search condition, where T-SQL has no boolean values, so boolean columns and
+ * constants have to be compared to 1.
+ */
+
+static void tdsDeparseExpr(Expr *node, TdsDeparseContext *context, bool is_condition)
+{
+	StringInfo buf = context->buf;
+
+	switch (nodeTag(node))
+	{
+		case T_Var:
+			if (((Var *) node)->varno != context->relid)
+			{
+				tdsDeparseParamRef((Node *) node, context, is_condition);
+				break;
+			}
+
+			if (is_condition)
+				appendStringInfoChar(buf, '(');
+
+			tdsDeparseColumnRef(((Var *) node)->varattno, context);
+
+			if (is_condition)
+				appendStringInfoString(buf, " = 1)");
+
+			break;
+
+		case T_Const:
+			tdsDeparseConst((Const *) node, context, is_condition);
+			break;
+
+		case T_Param:
+			tdsDeparseParamRef((Node *) node, context, is_condition);
+			break;
+
+		case T_RelabelType:
+			tdsDeparseExpr(((RelabelType *) node)->arg, context, is_condition);
+			break;
+
+		case T_OpExpr:
+		{
+			OpExpr *op = (OpExpr *) node;
+			char *opname = get_opname(op->opno);
+
+			appendStringInfoChar(buf, '(');
+			tdsDeparseExpr((Expr *) linitial(op->args), context, false);
+			appendStringInfo(buf, " %s ", opname);
+			tdsDeparseExpr((Expr *) lsecond(op->args), context, false);
+			appendStringInfoChar(buf, ')');
+
+			pfree(opname);
+			break;
+		}
+
+		case T_ScalarArrayOpExpr:
+		{
+			ScalarArrayOpExpr *saop = (ScalarArrayOpExpr *) node;
+			Const *array_const = (Const *) lsecond(saop->args);
+			ArrayType *array;
+			Oid element_type;
+			int16 typlen;
+			bool typbyval;
+			char typalign;
+			Datum *elements;
+			bool *nulls;
+			int nelements;
+			int i;
+
+			/*
+			 * the range of the values of an array parameter, which are computed at run time.
+			 * If the values are copied to a temporary table, they are joined there as well.
+			 */
+			if (IsA(array_const, Param))
+			{
+				int index = tdsGetParamIndex((Node *) array_const, context);
+
+				appendStringInfoString(buf, "(");
+				tdsDeparseExpr((Expr *) linitial(saop->args), context, false);
+				appendStringInfo(buf, " >= @fdw_param%d_min AND ", index);
+				tdsDeparseExpr((Expr *) linitial(saop->args), context, false);
+				appendStringInfo(buf, " <= @fdw_param%d_max", index);
+
+				if (list_member_int(context->staged_params, index))
+				{
+					appendStringInfoString(buf, " AND ");
+					tdsDeparseExpr((Expr *) linitial(saop->args), context, false);
+					appendStringInfo(buf, " IN (SELECT [value] FROM #fdw_param%d)", index);
+				}
+
+				appendStringInfoChar(buf, ')');
+				break;
+			}
+
+			array = DatumGetArrayTypeP(array_const->constvalue);
+			element_type = ARR_ELEMTYPE(array);
+
+			get_typlenbyvalalign(element_type, &typlen, &typbyval, &typalign);
+			deconstruct_array(array, element_type, typlen, typbyval, typalign,
+				&elements, &nulls, &nelements);
+
+			/* an empty IN list is a syntax error, but = ANY ('{}') is always false */
+			if (nelements == 0)
+			{
+				appendStringInfoString(buf, "(1 = 0)");
+				break;
+			}
+
+			appendStringInfoChar(buf, '(');
+			tdsDeparseExpr((Expr *) linitial(saop->args), context, false);
+			appendStringInfoString(buf, " IN (");
+
+			for (i = 0; i < nelements; i++)
+			{
+				if (i > 0)
+					appendStringInfoString(buf, ", ");
+
+				if (nulls[i])
+					appendStringInfoString(buf, "NULL");
+				else
+					tdsDeparseDatum(elements[i], element_type, context);
+			}
+
+			appendStringInfoString(buf, "))");
+			break;
+		}
+
+		case T_BoolExpr:
+		{
+			BoolExpr *b = (BoolExpr *) node;
+			ListCell *lc;
+			bool first = true;
+
+			if (b->boolop == NOT_EXPR)
+			{
+				appendStringInfoString(buf, "(NOT ");
+				tdsDeparseExpr((Expr *) linitial(b->args), context, true);
+				appendStringInfoChar(buf, ')');
+				break;
+			}
+
+			appendStringInfoChar(buf, '(');
+
+			foreach (lc, b->args)
+			{
+				if (!first)
+					appendStringInfoString(buf, b->boolop == AND_EXPR ? " AND " : " OR ");
+
+				tdsDeparseExpr((Expr *) lfirst(lc), context, true);
+				first = false;
+			}
+
+			appendStringInfoChar(buf, ')');
+			break;
+		}
+
+		case T_NullTest:
+		{
+			NullTest *nt = (NullTest *) node;
+
+			appendStringInfoChar(buf, '(');
+			tdsDeparseExpr(nt->arg, context, false);
+			appendStringInfoString(buf, nt->nulltesttype == IS_NULL ? " IS NULL)" : " IS NOT NULL)");
+			break;
+		}
+
+		default:
+			ereport(ERROR,
+				(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
+					errmsg("Unsupported expression type for deparse: %d", (int) nodeTag(node))
+				));
+	}
+}
+
+/* get the number of the parameter of sp_executesql for a Param, or a column of another relation */
+
+static int tdsGetParamIndex(Node *node, TdsDeparseContext *context)
+{
+	ListCell *lc;
+	int index = 1;
+
+	foreach (lc, context->remote_params)
+	{
+		if (equal(lfirst(lc), node))
+			break;
+
+		index++;
+	}
+
+	return index;
+}
+
+/* write the parameter of sp_executesql that is used for a Param, or a column of another relation */
+
+static void tdsDeparseParamRef(Node *node, TdsDeparseContext *context, bool is_condition)
+{
+	int index = tdsGetParamIndex(node, context);
+
+	if (is_condition)
+		appendStringInfoChar(context->buf, '(');
+
+	appendStringInfo(context->buf, "@fdw_param%d", index);
+
+	if (is_condition)
+		appendStringInfoString(context->buf, " = 1)");
+}
+
+static void tdsDeparseConst(Const *node, TdsDeparseContext *context, bool is_condition)
+{
+	if (is_condition)
+	{
+		/* a constant condition, e.g. from WHERE true */
+		if (!node->constisnull && DatumGetBool(node->constvalue))
+			appendStringInfoString(context->buf, "(1 = 1)");
+		else
+			appendStringInfoString(context->buf, "(1 = 0)");
+
+		return;
+	}
+
+	if (node->constisnull)
+	{
+		appendStringInfoString(context->buf, "NULL");
+		return;
+	}
+
+	tdsDeparseDatum(node->constvalue, node->consttype, context);
+}
+
+/* write a value as a T-SQL literal */
+
+static void tdsDeparseDatum(Datum value, Oid typid, TdsDeparseContext *context)
+{
+	StringInfo buf = context->buf;
+
+	switch (typid)
+	{
+		case BOOLOID:
+			appendStringInfoString(buf, DatumGetBool(value) ? "1" : "0");
+			break;
+
+		case INT2OID:
+		case INT4OID:
+		case INT8OID:
+		case NUMERICOID:
+		{
+			Oid typoutput;
+			bool typisvarlena;
+
+			getTypeOutputInfo(typid, &typoutput, &typisvarlena);
+			appendStringInfoString(buf, OidOutputFunctionCall(typoutput, value));
+			break;
+		}
+
+		/* use enough digits that the value is read back exactly */
+		case FLOAT4OID:
+			appendStringInfo(buf, "%.9g", (double) DatumGetFloat4(value));
+			break;
+
+		case FLOAT8OID:
+			appendStringInfo(buf, "%.17g", DatumGetFloat8(value));
+			break;
+
+		case DATEOID:
+		{
+			int year, month, day;
+
+			/* this format is not affected by SET DATEFORMAT or SET LANGUAGE */
+			j2date(DatumGetDateADT(value) + POSTGRES_EPOCH_JDATE, &year, &month, &day);
+			appendStringInfo(buf, "'%04d%02d%02d'", year, month, day);
+			break;
+		}
+
+		case TIMESTAMPOID:
+		{
+			struct pg_tm tm;
+			fsec_t fsec;
+
+			timestamp2tm(DatumGetTimestamp(value), NULL, &tm, &fsec, NULL, NULL);
+
+			appendStringInfo(buf, "'%04d-%02d-%02dT%02d:%02d:%02d",
+				tm.tm_year, tm.tm_mon, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec);
+
+			#ifdef HAVE_INT64_TIMESTAMP
+				if (fsec != 0)
+					appendStringInfo(buf, ".%03d", (int) (fsec / 1000));
+			#endif
+
+			appendStringInfoChar(buf, '\'');
+			break;
+		}
+
+		case TEXTOID:
+		case VARCHAROID:
+		case BPCHAROID:
+		{
+			char *str = TextDatumGetCString(value);
+			const char *ch;
+			bool is_ascii = true;
+
+			for (ch = str; *ch; ch++)
+			{
+				if (IS_HIGHBIT_SET(*ch))
+					is_ascii = false;
+			}
+
+			/*
+			 * A national string is only used when it is needed, because comparing a
+			 * varchar column to one would prevent the use of an index.
+			 */
+			if (!is_ascii || context->national)
+				appendStringInfoChar(buf, 'N');
+
+			appendStringInfoChar(buf, '\'');
+
+			for (ch = str; *ch; ch++)
+			{
+				if (*ch == '\'')
+					appendStringInfoChar(buf, '\'');
+
+				appendStringInfoChar(buf, *ch);
+			}
+
+			appendStringInfoChar(buf, '\'');
+			pfree(str);
+			break;
+		}
+
+		default:
+			ereport(ERROR,
+				(errcode(ERRCODE_FDW_INVALID_DATA_TYPE),
+					errmsg("Unsupported data type for deparse: %u", typid)
+				));
+	}
+}
+
+/* add the select list for the retrieved columns */
+
+static void tdsDeparseSelectList(StringInfo buf, Relation rel, TdsFdwOptionSet* option_set, List *retrieved_attrs)
+{
+	TupleDesc tupdesc = RelationGetDescr(rel);
+	ListCell *lc;
+	bool first = true;
+
+	/* nothing is needed, e.g. for SELECT count(*) */
+	if (retrieved_attrs == NIL)
+	{
+		appendStringInfoString(buf, "NULL");
+		return;
+	}
+
+	foreach (lc, retrieved_attrs)
+	{
+		int attnum = lfirst_int(lc);
+		Form_pg_attribute attr = tupdesc->attrs[attnum - 1];
+		TdsFdwColumnOption *column = &option_set->columns[attnum - 1];
+		const char *column_name;
+
+		if (!first)
+			appendStringInfoString(buf, ", ");
+
+		first = false;
+
+		/* keep the positions of the result columns lined up with the local columns */
+		if (attr->attisdropped)
+		{
+			appendStringInfoString(buf, "NULL");
+			continue;
+		}
+
+		column_name = tdsGetColumnName(rel, option_set, attnum);
+
+		if (column->compress && tdsDialectHasCompress(&option_set->dialect))
+		{
+			/*
+			 * Text is always compressed as nvarchar, so the decompressed value is
+			 * UTF-16LE no matter what the remote column type is.
+			 */
+			if (attr->atttypid == BYTEAOID)
+				appendStringInfoString(buf, "COMPRESS(");
+			else
+				appendStringInfoString(buf, "COMPRESS(CAST(");
+
+			tdsQuoteIdentifier(buf, column_name);
+
+			if (attr->atttypid == BYTEAOID)
+				appendStringInfoString(buf, ")");
+			else
+				appendStringInfoString(buf, " AS nvarchar(max)))");
+
+			appendStringInfoString(buf, " AS ");
+		}
+
+		tdsQuoteIdentifier(buf, column_name);
+	}
+}
+
+/* add the ORDER BY clause */
+
+static void tdsDeparseOrderBy(List *sort_items, TdsDeparseContext *context)
+{
+	StringInfo buf = context->buf;
+	ListCell *lc;
+	bool first = true;
+
+	appendStringInfoString(buf, " ORDER BY ");
+
+	foreach (lc, sort_items)
+	{
+		List *sort_item = (List *) lfirst(lc);
+		Var *var = (Var *) linitial(sort_item);
+		bool descending = intVal(lsecond(sort_item));
+		bool nulls_first = intVal(lthird(sort_item));
+
+		if (!first)
+			appendStringInfoString(buf, ", ");
+
+		first = false;
+
+		/*
+		 * NULL is the lowest value on the foreign server, so it comes first in
+		 * ascending order and last in descending order. The other placements
+		 * need a CASE.
+		 */
+		if (nulls_first == descending)
+		{
+			appendStringInfoString(buf, "CASE WHEN ");
+			tdsDeparseColumnRef(var->varattno, context);
+			appendStringInfo(buf, " IS NULL THEN %d ELSE %d END, ", nulls_first ? 0 : 1, nulls_first ? 1 : 0);
+		}
+
+		tdsDeparseColumnRef(var->varattno, context);
+		appendStringInfoString(buf, descending ? " DESC" : " ASC");
+	}
+}
+
+/*
+ * add the OPTION clause, which only SQL Server has. FAST n asks for a plan that
+ * returns the first rows quickly, when only those are likely to be fetched.
+ */
+
+static void tdsDeparseQueryHints(StringInfo buf, TdsFdwOptionSet *option_set, TdsFdwRemoteScan *remote_scan)
+{
+	StringInfoData hints;
+
+	if (!tdsIsSqlServerVersion(&option_set->dialect, 0))
+		return;
+
+	initStringInfo(&hints);
+
+	if (remote_scan->fast_rows > 0)
+		appendStringInfo(&hints, "%sFAST %i", hints.len > 0 ? ", " : "", remote_scan->fast_rows);
+
+	if (option_set->maxdop >= 0)
+		appendStringInfo(&hints, "%sMAXDOP %i", hints.len > 0 ? ", " : "", option_set->maxdop);
+
+	if (option_set->recompile && tdsIsSqlServerVersion(&option_set->dialect, 9))
+		appendStringInfo(&hints, "%sRECOMPILE", hints.len > 0 ? ", " : "");
+
+	if (hints.len > 0)
+		appendStringInfo(buf, " OPTION (%s)", hints.data);
+
+	pfree(hints.data);
+}
+
+/* build the query to send to the foreign server */
+
+char* tdsBuildQuery(Relation rel, TdsFdwOptionSet* option_set, TdsFdwRemoteScan* remote_scan)
+{
+	StringInfoData buf;
+	TdsDeparseContext context;
+	char *query = option_set->query;
+	bool compress = false;
+	int i;
+
+	#ifdef DEBUG
+		ereport(NOTICE,
+			(errmsg("----> starting tdsBuildQuery")
+			));
+	#endif
+
+	/* placeholders are sent as parameters of sp_executesql */
+	if (query && option_set->nplaceholders > 0)
+		query = tdsReplacePlaceholders(query);
+
+	if (query && !remote_scan->pushdown)
+	{
+		#ifdef DEBUG
+			ereport(NOTICE,
+				(errmsg("Query is explicitly set")
+				));
+		#endif
+
+		return query;
+	}
+
+	for (i = 0; i < option_set->ncolumns; i++)
+	{
+		if (option_set->columns[i].compress && tdsDialectHasCompress(&option_set->dialect))
+			compress = true;
+	}
+
+	initStringInfo(&buf);
+	context.buf = &buf;
+	context.rel = rel;
+	context.option_set = option_set;
+	context.national = false;
+	context.dialect = &option_set->dialect;
+	context.relid = remote_scan->relid;
+	context.remote_params = remote_scan->remote_params;
+	context.staged_params = remote_scan->staged_params;
+
+	appendStringInfoString(&buf, "SELECT ");
+
+	/* without TOP, the rows after the limit are cancelled */
+	if (remote_scan->pushdown && remote_scan->limit > 0 && tdsDialectHasTop(&option_set->dialect))
+		appendStringInfo(&buf, "TOP %i ", remote_scan->limit);
+
+	if (remote_scan->pushdown)
+	{
+		tdsDeparseSelectList(&buf, rel, option_set, remote_scan->retrieved_attrs);
+	}
+
+	else if (compress)
+	{
+		List *retrieved_attrs = NIL;
+
+		#ifdef DEBUG
+			ereport(NOTICE,
+				(errmsg("Building select list for compressed columns")
+				));
+		#endif
+
+		for (i = 1; i <= option_set->ncolumns; i++)
+			retrieved_attrs = lappend_int(retrieved_attrs, i);
+
+		tdsDeparseSelectList(&buf, rel, option_set, retrieved_attrs);
+	}
+
+	else
+	{
+		appendStringInfoString(&buf, "*");
+	}
+
+	/* a query is used as a derived table, so that it can be filtered and sorted */
+	if (query)
+		appendStringInfo(&buf, " FROM (%s) AS q", query);
+	else
+		appendStringInfo(&buf, " FROM %s", option_set->table);
+
+	if (!query && option_set->table_hints && tdsIsSqlServerVersion(&option_set->dialect, 0))
+		appendStringInfo(&buf, " WITH (%s)", option_set->table_hints);
+
+	if (remote_scan->pushdown && remote_scan->remote_exprs != NIL)
+	{
+		ListCell *lc;
+		bool first = true;
+
+		appendStringInfoString(&buf, " WHERE ");
+
+		foreach (lc, remote_scan->remote_exprs)
+		{
+			if (!first)
+				appendStringInfoString(&buf, " AND ");
+
+			tdsDeparseExpr((Expr *) lfirst(lc), &context, true);
+			first = false;
+		}
+	}
+
+	if (remote_scan->pushdown && remote_scan->sort_items != NIL)
+		tdsDeparseOrderBy(remote_scan->sort_items, &context);
+
+	tdsDeparseQueryHints(&buf, option_set, remote_scan);
+
+	#ifdef DEBUG
+		ereport(NOTICE,
+			(errmsg("Value of query is %s", buf.data)
+			));
+		ereport(NOTICE,
+			(errmsg("----> finishing tdsBuildQuery")
+			));
+	#endif
+
+	return buf.data;
+}
+
+/*
+ * build the start of the query that fetches the lazy columns of some rows. The
+ * key column comes first, and the values of the keys are added after the IN.
+ */
+
+char* tdsBuildLazyQuery(Relation rel, TdsFdwOptionSet* option_set, List *lazy_attrs)
+{
+	StringInfoData buf;
+
+	initStringInfo(&buf);
+
+	appendStringInfoString(&buf, "SELECT ");
+	tdsDeparseSelectList(&buf, rel, option_set, lcons_int(option_set->key_attnum, list_copy(lazy_attrs)));
+
+	if (option_set->query)
+		appendStringInfo(&buf, " FROM (%s) AS q", option_set->query);
+	else
+		appendStringInfo(&buf, " FROM %s", option_set->table);
+
+	if (!option_set->query && option_set->table_hints && tdsIsSqlServerVersion(&option_set->dialect, 0))
+		appendStringInfo(&buf, " WITH (%s)", option_set->table_hints);
+
+	appendStringInfoString(&buf, " WHERE ");
+	tdsQuoteIdentifier(&buf, tdsGetColumnName(rel, option_set, option_set->key_attnum));
+	appendStringInfoString(&buf, " IN (");
+
+	#ifdef DEBUG
+		ereport(NOTICE,
+			(errmsg("Value of lazy query is %s", buf.data)
+			));
+	#endif
+
+	return buf.data;
+}
+
+/* add a value of a pushable type as a T-SQL literal */
+
+void tdsAppendValue(StringInfo buf, Datum value, Oid typid)
+{
+	TdsDeparseContext context;
+
+	context.buf = buf;
+	context.rel = NULL;
+	context.option_set = NULL;
+	context.national = false;
+	context.dialect = NULL;
+	context.relid = 0;
+	context.remote_params = NIL;
+	context.staged_params = NIL;
+
+	tdsDeparseDatum(value, typid, &context);
+}
+
+/*
+ * Build a call to sp_executesql that runs the query with the values of its
+ * parameters, so that the foreign server can reuse the plan. Scans send the
+ * query as a remote procedure call instead; this is for the planner, which
+ * runs the query without values. Sybase ASE has no sp_executesql, so there
+ * the parameters are declared as variables in a batch that runs the query.
+ */
+
+char* tdsBuildExecuteSql(const char *query, TdsFdwParameter *params, int nparams, const TdsFdwDialect *dialect)
+{
+	StringInfoData buf;
+	TdsDeparseContext context;
+	const char *ch;
+	int i;
+
+	initStringInfo(&buf);
+	context.buf = &buf;
+	context.rel = NULL;
+	context.option_set = NULL;
+	context.national = tdsDialectHasParameters(dialect);
+	context.dialect = dialect;
+	context.relid = 0;
+	context.remote_params = NIL;
+	context.staged_params = NIL;
+
+	if (!tdsDialectHasParameters(dialect))
+	{
+		appendStringInfo(&buf, "DECLARE %s", tdsGetParameterDeclarations(params, nparams, dialect));
+
+		for (i = 0; i < nparams; i++)
+		{
+			appendStringInfo(&buf, "%s@%s = ", i > 0 ? ", " : " SELECT ", params[i].name);
+
+			if (params[i].isnull)
+				appendStringInfoString(&buf, "NULL");
+			else
+				tdsDeparseDatum(params[i].value, params[i].valuetype, &context);
+		}
+
+		appendStringInfo(&buf, " %s", query);
+
+		#ifdef DEBUG
+			ereport(NOTICE,
+				(errmsg("Value of parameterized query is %s", buf.data)
+				));
+		#endif
+
+		return buf.data;
+	}
+
+	appendStringInfoString(&buf, "EXEC sp_executesql N'");
+
+	for (ch = query; *ch; ch++)
+	{
+		if (*ch == '\'')
+			appendStringInfoChar(&buf, '\'');
+
+		appendStringInfoChar(&buf, *ch);
+	}
+
+	appendStringInfo(&buf, "', N'%s'", tdsGetParameterDeclarations(params, nparams, dialect));
+
+	for (i = 0; i < nparams; i++)
+	{
+		appendStringInfo(&buf, ", @%s = ", params[i].name);
+
+		if (params[i].isnull)
+			appendStringInfoString(&buf, "NULL");
+		else
+			tdsDeparseDatum(params[i].value, params[i].valuetype, &context);
+	}
+
+	#ifdef DEBUG
+		ereport(NOTICE,
+			(errmsg("Value of parameterized query is %s", buf.data)
+			));
+	#endif
+
+	return buf.data;
+}
@@ -18,13 +18,25 @@
 
 #include "postgres.h"
 
+#include <ctype.h>
+#include <errno.h>
+#include <math.h>
+#include <poll.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include <zlib.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include "funcapi.h"
+#include "access/heapam.h"
 #include "access/reloptions.h"
+#include "catalog/pg_attribute.h"
 #include "catalog/pg_foreign_server.h"
 #include "catalog/pg_foreign_table.h"
 #include "catalog/pg_user_mapping.h"
@@ -35,22 +47,37 @@
 #include "foreign/foreign.h"
 #include "miscadmin.h"
 #include "mb/pg_wchar.h"
+#include "nodes/nodeFuncs.h"
 #include "optimizer/cost.h"
 #include "storage/fd.h"
 #include "utils/array.h"
 #include "utils/builtins.h"
+#include "utils/date.h"
+#include "utils/datum.h"
+#include "utils/guc.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
 #include "utils/rel.h"
+#include "utils/timestamp.h"
+#include "utils/typcache.h"
+#include "utils/uuid.h"
 
 #if (PG_VERSION_NUM >= 90200)
+#include "access/skey.h"
+#include "access/sysattr.h"
+#include "access/transam.h"
+#include "nodes/makefuncs.h"
+#include "optimizer/clauses.h"
 #include "optimizer/pathnode.h"
+#include "optimizer/paths.h"
 #include "optimizer/restrictinfo.h"
 #include "optimizer/planmain.h"
+#include "optimizer/var.h"
+#include "rewrite/rewriteManip.h"
 #endif
 
 
-/* DB-Library headers (e.g. FreeTDS */
-#include <sybfront.h>
-#include <sybdb.h>
+#include "tds_fdw.h"
 
 /*#define DEBUG*/
 
@@ -74,56 +101,44 @@ static struct TdsFdwOption valid_options[] =
 	{ "language",		ForeignServerRelationId },
 	{ "character_set",		ForeignServerRelationId },
 	{ "port",			ForeignServerRelationId },
+	{ "packet_size",	ForeignServerRelationId },
+	{ "staging_threshold",	ForeignServerRelationId },
+	{ "maxdop",			ForeignServerRelationId },
+	{ "table_hints",	ForeignServerRelationId },
+	{ "isolation_level",	ForeignServerRelationId },
+	{ "fetch_size",		ForeignServerRelationId },
+	{ "text_size",		ForeignServerRelationId },
 	{ "username",		UserMappingRelationId },
 	{ "password",		UserMappingRelationId },
 	{ "database",		ForeignTableRelationId },
 	{ "query", 			ForeignTableRelationId },
 	{ "table",			ForeignTableRelationId },
+	{ "compress",		ForeignTableRelationId },
+	{ "derived_table",	ForeignTableRelationId },
+	{ "staging_threshold",	ForeignTableRelationId },
+	{ "maxdop",			ForeignTableRelationId },
+	{ "recompile",		ForeignTableRelationId },
+	{ "table_hints",	ForeignTableRelationId },
+	{ "isolation_level",	ForeignTableRelationId },
+	{ "fetch_size",		ForeignTableRelationId },
+	{ "text_size",		ForeignTableRelationId },
+	{ "key_column",		ForeignTableRelationId },
+	{ "column_name",	AttributeRelationId },
+	{ "compress",		AttributeRelationId },
+	{ "lazy",			AttributeRelationId },
+	{ "placeholder",	AttributeRelationId },
+	{ "placeholder_from",	AttributeRelationId },
+	{ "placeholder_to",	AttributeRelationId },
 	{ NULL,				InvalidOid }
 };
 
-/* option values will be put here */
-
-typedef struct TdsFdwOptionSet
-{
-	char *servername;
-	char *language;
-	char *character_set;
-	int port;
-	char *username;
-	char *password;
-	char *database;
-	char *query;
-	char *table;
-} TdsFdwOptionSet;
-
-/* a column */
-
-typedef struct COL
-{
-	char *name;
-	char *buffer;
-	int type, size, status;
-} COL;
-
-/* this maintains state */
-
-typedef struct TdsFdwExecutionState
-{
-	LOGINREC *login;
-	DBPROCESS *dbproc;
-	char *query;
-	int first;
-	COL *columns;
-	int ncols;
-	int row;
-} TdsFdwExecutionState;
-
 /* functions called via SQL */
 
 extern Datum tds_fdw_handler(PG_FUNCTION_ARGS);
 extern Datum tds_fdw_validator(PG_FUNCTION_ARGS);
 
+void _PG_init(void);
+
 PG_FUNCTION_INFO_V1(tds_fdw_handler);
 PG_FUNCTION_INFO_V1(tds_fdw_validator);
 
@@ -142,6 +157,21 @@ static void tdsEstimateCosts(PlannerInfo *root, RelOptInfo *baserel, Cost *start
 static void tdsGetForeignPaths(PlannerInfo *root, RelOptInfo *baserel, Oid foreigntableid);
 static bool tdsAnalyzeForeignTable(Relation relation, AcquireSampleRowsFunc *func, BlockNumber *totalpages);
 static ForeignScan* tdsGetForeignPlan(PlannerInfo *root, RelOptInfo *baserel, Oid foreigntableid, ForeignPath *best_path, List *tlist, List *scan_clauses);
+static void tdsGetPlaceholderExprs(RelOptInfo *baserel, TdsFdwOptionSet *option_set, List *scan_clauses, List **placeholder_names, List **placeholder_exprs);
+static void tdsAddParameterizedPaths(PlannerInfo *root, RelOptInfo *baserel, Cost startup_cost);
+static List* tdsGetStagedParams(PlannerInfo *root, List *remote_params, int staging_threshold);
+static double tdsEstimateArrayLength(PlannerInfo *root, Node *node);
+#if (PG_VERSION_NUM >= 90300)
+static bool tdsEcMemberMatches(PlannerInfo *root, RelOptInfo *rel, EquivalenceClass *ec, EquivalenceMember *em, void *arg);
+#endif
+static List* tdsGetRetrievedAttrs(TdsFdwRelationInfo *fpinfo);
+static List* tdsGetLazyAttrs(PlannerInfo *root, RelOptInfo *baserel, TdsFdwRelationInfo *fpinfo, List *retrieved_attrs,
+	List *local_exprs, bool late_fetch);
+static int32 tdsGetAttrWidth(PlannerInfo *root, RelOptInfo *baserel, int attnum);
+static Cost tdsGetLazyFetchCost(PlannerInfo *root, RelOptInfo *baserel, TdsFdwRelationInfo *fpinfo, List *lazy_attrs);
+static List* tdsGetSortItems(RelOptInfo *baserel, List *pathkeys);
+static int tdsGetRemoteLimit(PlannerInfo *root, RelOptInfo *baserel, TdsFdwRelationInfo *fpinfo, Path *path);
+static int tdsGetFastRows(PlannerInfo *root, RelOptInfo *baserel, int limit);
 /* routines for versions older than 9.2.0 */
 #else
 static FdwPlan* tdsPlanForeignScan(Oid foreigntableid, PlannerInfo *root, RelOptInfo *baserel);
@@ -152,10 +182,67 @@ static FdwPlan* tdsPlanForeignScan(Oid foreigntableid, PlannerInfo *root, RelOpt
 static bool tdsIsValidOption(const char *option, Oid context);
 static void tdsOptionSetInit(TdsFdwOptionSet* option_set);
 static void tdsGetOptions(Oid foreigntableid, TdsFdwOptionSet* option_set);
+static void tdsGetColumnOptions(Oid foreigntableid, TdsFdwOptionSet* option_set);
+static void tdsValidatePlaceholderName(const char *name);
+static void tdsValidateTableHints(const char *table_hints);
+static void tdsValidateIsolationLevel(const char *isolation_level);
+static void tdsGetPlaceholders(TupleDesc tupdesc, TdsFdwOptionSet* option_set);
+static void tdsEvaluateParameters(ForeignScanState *node);
+static void tdsGetArrayRange(Datum value, bool isnull, TdsFdwParameter *min_param, TdsFdwParameter *max_param,
+	const TdsFdwDialect *dialect);
+static int tdsGetBinaryValue(Oid typid, bool isnull, Datum value, BYTE **data, DBINT *datalen);
+static void tdsAddRpcParameter(DBPROCESS *dbproc, const char *name, Oid typid, bool isnull, Datum value);
+static void tdsStageArray(TdsFdwExecutionState *festate, int index, Oid element_type, Datum value, bool isnull);
+static void tdsPrepareQuery(TdsFdwExecutionState *festate);
+static RETCODE tdsSendParameterizedQuery(TdsFdwExecutionState *festate);
+static void tdsSendQuery(ForeignScanState *node);
+static bool tdsCanSendAtBegin(ForeignScanState *node);
+#if (PG_VERSION_NUM >= 90200)
+static bool tdsContainsExecParam(Node *node, void *context);
+#endif
 static int tdsSetupConnection(TdsFdwOptionSet* option_set, LOGINREC *login, DBPROCESS **dbproc);
+static void tdsGetDialect(TdsFdwOptionSet* option_set, DBPROCESS *dbproc);
+static void tdsParseVersion(const char *version, TdsFdwDialect *dialect);
 static int tdsGetRowCount(TdsFdwOptionSet* option_set, LOGINREC *login, DBPROCESS *dbproc);
 static int tdsGetStartupCost(TdsFdwOptionSet* option_set);
+static int tdsGetConvertedLength(int srctype, DBINT srclen);
 static char* tdsConvertToCString(DBPROCESS* dbproc, int srctype, const BYTE* src, DBINT srclen);
+static void tdsWaitForResponse(DBPROCESS *dbproc);
+static void tdsCancelQuery(TdsFdwExecutionState *festate);
+static void tdsGetColumns(ForeignScanState *node);
+static void tdsFetchBatch(ForeignScanState *node);
+static void tdsFilterBatch(ForeignScanState *node);
+static void tdsFetchLazyColumns(ForeignScanState *node);
+static void tdsLookupLazyColumns(ForeignScanState *node, int first_row, int end_row, bool *found);
+static void tdsGetLazyColumns(ForeignScanState *node);
+static TdsFdwColumnDecoder tdsGetColumnDecoder(TdsFdwExecutionState *festate, COL *column);
+static Datum tdsInputValue(TdsFdwExecutionState *festate, COL *column, char *str, bool *isnull);
+static Datum tdsDecodeConverted(TdsFdwExecutionState *festate, COL *column, BYTE *src, DBINT srclen, bool *isnull);
+static Datum tdsDecodeCompressed(TdsFdwExecutionState *festate, COL *column, BYTE *src, DBINT srclen, bool *isnull);
+static Datum tdsDecodeNull(TdsFdwExecutionState *festate, COL *column, BYTE *src, DBINT srclen, bool *isnull);
+static Datum tdsDecodeTinyInt(TdsFdwExecutionState *festate, COL *column, BYTE *src, DBINT srclen, bool *isnull);
+static Datum tdsDecodeSmallInt(TdsFdwExecutionState *festate, COL *column, BYTE *src, DBINT srclen, bool *isnull);
+static Datum tdsDecodeInt(TdsFdwExecutionState *festate, COL *column, BYTE *src, DBINT srclen, bool *isnull);
+static Datum tdsDecodeBigInt(TdsFdwExecutionState *festate, COL *column, BYTE *src, DBINT srclen, bool *isnull);
+static Datum tdsDecodeReal(TdsFdwExecutionState *festate, COL *column, BYTE *src, DBINT srclen, bool *isnull);
+static Datum tdsDecodeFloat(TdsFdwExecutionState *festate, COL *column, BYTE *src, DBINT srclen, bool *isnull);
+static Datum tdsDecodeBit(TdsFdwExecutionState *festate, COL *column, BYTE *src, DBINT srclen, bool *isnull);
+static Datum tdsDecodeUniqueIdentifier(TdsFdwExecutionState *festate, COL *column, BYTE *src, DBINT srclen, bool *isnull);
+static size_t tdsAsciiLength(const unsigned char *src, size_t len);
+static Datum tdsDecodeText(TdsFdwExecutionState *festate, COL *column, BYTE *src, DBINT srclen, bool *isnull);
+static Datum tdsDecodeBinary(TdsFdwExecutionState *festate, COL *column, BYTE *src, DBINT srclen, bool *isnull);
+static Datum tdsDecodeNumeric(TdsFdwExecutionState *festate, COL *column, BYTE *src, DBINT srclen, bool *isnull);
+static Datum tdsDecodeMoney(TdsFdwExecutionState *festate, COL *column, BYTE *src, DBINT srclen, bool *isnull);
+static Datum tdsDecodeSmallMoney(TdsFdwExecutionState *festate, COL *column, BYTE *src, DBINT srclen, bool *isnull);
+static Datum tdsDecodeDateTime(TdsFdwExecutionState *festate, COL *column, BYTE *src, DBINT srclen, bool *isnull);
+static Datum tdsDecodeSmallDateTime(TdsFdwExecutionState *festate, COL *column, BYTE *src, DBINT srclen, bool *isnull);
+static Datum tdsDecodeDateTimeAll(TdsFdwExecutionState *festate, COL *column, BYTE *src, DBINT srclen, bool *isnull);
+static Datum tdsMoneyToNumeric(TdsFdwExecutionState *festate, COL *column, int64 value, bool *isnull);
+static Datum tdsDateTimeToDatum(COL *column, int64 days, int64 usecs, int offset, int32 typmod);
+static char* tdsDecompressToCString(const BYTE* src, DBINT srclen, bool is_bytea);
+static char* tdsUtf16ToServerEncoding(const unsigned char* src, size_t srclen);
+static void tdsRemoteScanInit(TdsFdwRemoteScan* remote_scan);
+static void tdsGetRemoteScan(ForeignScanState *node, TdsFdwRemoteScan* remote_scan);
 
 /* Helper functions for DB-Library API */
 
@@ -166,6 +253,118 @@ int tds_msg_handler(DBPROCESS *dbproc, DBINT msgno, int msgstate, int severity,
 
 static const char *DEFAULT_SERVERNAME = "127.0.0.1";
 
+/* what was found about a foreign server, which is kept for the life of the backend */
+
+typedef struct TdsFdwDialectCacheEntry
+{
+	char *servername;
+	int port;
+	TdsFdwDialect dialect;
+} TdsFdwDialectCacheEntry;
+
+static List *dialect_cache = NIL;
+
+#if (PG_VERSION_NUM >= 90300)
+
+/* state for finding the equivalence class members of the foreign table */
+
+typedef struct TdsEcMemberContext
+{
+	Expr *current;
+	List *already_used;
+} TdsEcMemberContext;
+
+#endif
+
+/* how much more a scan costs if the foreign server has to sort it */
+
+static const double DEFAULT_SORT_MULTIPLIER = 1.2;
+
+/* what a lookup of lazy columns on the foreign server is taken to cost, in bytes transferred */
+
+static const double LAZY_LOOKUP_BYTES = 65536;
+
+/* the cost of transferring a byte from the foreign server, next to the cost of 1 for each row */
+
+static const double TRANSFER_BYTE_COST = 1.0 / 8192;
+
+/* the most keys that are looked up at a time, which stays below the 2100 parameters that SQL Server allows */
+
+static const int LAZY_LOOKUP_KEYS = 1000;
+
+/* the width that the planner guesses for a variable-width column without statistics */
+
+static const int DEFAULT_COLUMN_WIDTH = 32;
+
+/*
+ * the default limit on the length of text, image and (max) values. The
+ * foreign server cuts longer values to the TEXTSIZE of the connection, and
+ * FreeTDS sets a small one by default.
+ */
+
+static const int DEFAULT_TEXT_SIZE = 2147483647;
+
+/* how many values are copied to the foreign server before they are committed */
+
+static const int STAGING_BATCH_SIZE = 1000;
+
+/* how long a value of a type other than text or binary can get when it is converted to text */
+
+static const int CONVERTED_VALUE_LENGTH = 1000;
+
+/* how often interrupts are checked while waiting for the foreign server, in milliseconds */
+
+static const int RESPONSE_POLL_INTERVAL = 100;
+
+/* the largest buffer that is allocated for a column before its first value is seen */
+
+static const int MAX_COLUMN_BUFFER_SIZE = 65536;
+
+/* about how much memory a batch of rows may use, and how wide a long value is taken to be for that */
+
+static const int BATCH_MEMORY_SIZE = 4 * 1024 * 1024;
+static const int BATCH_VALUE_SIZE = 8192;
+
+/* the number of rows that are fetched at a time, if the server or table does not set fetch_size */
+
+static int tds_fdw_fetch_size = 100;
+
+void _PG_init(void)
+{
+	DefineCustomIntVariable("tds_fdw.fetch_size",
+		"Sets the default number of rows that are fetched from a foreign server at a time.",
+		"This is used for the foreign servers and tables that have no fetch_size option.",
+		&tds_fdw_fetch_size,
+		100,
+		1,
+		INT_MAX,
+		PGC_USERSET,
+		0,
+		NULL,
+		NULL,
+		NULL);
+}
+
+/* the days from 1900-01-01, where the dates of DB-Library start, to 2000-01-01, where those of PostgreSQL start */
+
+static const int TDS_EPOCH_DAYS = 36524;
+
+/* how many bytes the magnitude of a DBNUMERIC of each precision has, including the sign byte */
+
+static const int TDS_NUMERIC_BYTES[] = {
+	1,
+	2, 2, 3, 3, 4, 4, 4, 5, 5, 6,
+	6, 6, 7, 7, 8, 8, 9, 9, 9, 10,
+	10, 11, 11, 11, 12, 12, 13, 13, 14, 14,
+	14, 15, 15, 16, 16, 16, 17, 17, 18, 18,
+	19, 19, 19, 20, 20, 21, 21, 21, 22, 22,
+	23, 23, 24, 24, 24, 25, 25, 26, 26, 26,
+	27, 27, 28, 28, 28, 29, 29, 30, 30, 31,
+	31, 31, 32, 32, 33, 33, 33
+};
+
+#define TDS_NUMERIC_MAX_PRECISION 77
+
 Datum tds_fdw_handler(PG_FUNCTION_ARGS)
 {
 	FdwRoutine *fdwroutine = makeNode(FdwRoutine);
@@ -205,6 +404,15 @@ Datum tds_fdw_validator(PG_FUNCTION_ARGS)
 	List *options_list = untransformRelOptions(PG_GETARG_DATUM(0));
 	Oid catalog = PG_GETARG_OID(1);
 	TdsFdwOptionSet option_set;
+	char *column_name = NULL;
+	char *placeholder = NULL;
+	char *placeholder_from = NULL;
+	char *placeholder_to = NULL;
+	bool compress_set = false;
+	bool derived_table_set = false;
+	bool staging_threshold_set = false;
+	bool recompile_set = false;
+	bool lazy_set = false;
 	ListCell *cell;
 	
 	#ifdef DEBUG
@@ -288,6 +496,24 @@ Datum tds_fdw_validator(PG_FUNCTION_ARGS)
 			option_set.port = atoi(defGetString(def));	
 		}
 		
+		else if (strcmp(def->defname, "packet_size") == 0)
+		{
+			if (option_set.packet_size)
+				ereport(ERROR,
+					(errcode(ERRCODE_SYNTAX_ERROR),
+						errmsg("Redundant option: packet_size (%s)", defGetString(def))
+					));
+					
+			option_set.packet_size = atoi(defGetString(def));
+			
+			/* the sizes that TDS allows */
+			if (option_set.packet_size < 512 || option_set.packet_size > 32767)
+				ereport(ERROR,
+					(errcode(ERRCODE_FDW_INVALID_ATTRIBUTE_VALUE),
+						errmsg("Invalid value for packet_size: %s", defGetString(def))
+					));
+		}
+		
 		else if (strcmp(def->defname, "username") == 0)
 		{
 			if (option_set.username)
@@ -354,6 +580,209 @@ Datum tds_fdw_validator(PG_FUNCTION_ARGS)
 					
 			option_set.table = defGetString(def);
 		}
+		
+		else if (strcmp(def->defname, "compress") == 0)
+		{
+			if (compress_set)
+				ereport(ERROR,
+					(errcode(ERRCODE_SYNTAX_ERROR),
+						errmsg("Redundant option: compress (%s)", defGetString(def))
+					));
+					
+			/* this will throw an error if the value is not a valid boolean */
+			option_set.compress = defGetBoolean(def);
+			compress_set = true;
+		}
+		
+		else if (strcmp(def->defname, "derived_table") == 0)
+		{
+			if (derived_table_set)
+				ereport(ERROR,
+					(errcode(ERRCODE_SYNTAX_ERROR),
+						errmsg("Redundant option: derived_table (%s)", defGetString(def))
+					));
+					
+			/* this will throw an error if the value is not a valid boolean */
+			option_set.derived_table = defGetBoolean(def);
+			derived_table_set = true;
+		}
+		
+		else if (strcmp(def->defname, "staging_threshold") == 0)
+		{
+			if (staging_threshold_set)
+				ereport(ERROR,
+					(errcode(ERRCODE_SYNTAX_ERROR),
+						errmsg("Redundant option: staging_threshold (%s)", defGetString(def))
+					));
+					
+			option_set.staging_threshold = atoi(defGetString(def));
+			staging_threshold_set = true;
+			
+			if (option_set.staging_threshold < 0)
+				ereport(ERROR,
+					(errcode(ERRCODE_FDW_INVALID_ATTRIBUTE_VALUE),
+						errmsg("Invalid value for staging_threshold: %s", defGetString(def))
+					));
+		}
+		
+		else if (strcmp(def->defname, "maxdop") == 0)
+		{
+			if (option_set.maxdop >= 0)
+				ereport(ERROR,
+					(errcode(ERRCODE_SYNTAX_ERROR),
+						errmsg("Redundant option: maxdop (%s)", defGetString(def))
+					));
+					
+			option_set.maxdop = atoi(defGetString(def));
+			
+			if (option_set.maxdop < 0)
+				ereport(ERROR,
+					(errcode(ERRCODE_FDW_INVALID_ATTRIBUTE_VALUE),
+						errmsg("Invalid value for maxdop: %s", defGetString(def))
+					));
+		}
+		
+		else if (strcmp(def->defname, "fetch_size") == 0)
+		{
+			if (option_set.fetch_size >= 0)
+				ereport(ERROR,
+					(errcode(ERRCODE_SYNTAX_ERROR),
+						errmsg("Redundant option: fetch_size (%s)", defGetString(def))
+					));
+					
+			option_set.fetch_size = atoi(defGetString(def));
+			
+			if (option_set.fetch_size <= 0)
+				ereport(ERROR,
+					(errcode(ERRCODE_FDW_INVALID_ATTRIBUTE_VALUE),
+						errmsg("Invalid value for fetch_size: %s", defGetString(def))
+					));
+		}
+		
+		else if (strcmp(def->defname, "text_size") == 0)
+		{
+			if (option_set.text_size >= 0)
+				ereport(ERROR,
+					(errcode(ERRCODE_SYNTAX_ERROR),
+						errmsg("Redundant option: text_size (%s)", defGetString(def))
+					));
+					
+			option_set.text_size = atoi(defGetString(def));
+			
+			if (option_set.text_size <= 0)
+				ereport(ERROR,
+					(errcode(ERRCODE_FDW_INVALID_ATTRIBUTE_VALUE),
+						errmsg("Invalid value for text_size: %s", defGetString(def))
+					));
+		}
+		
+		else if (strcmp(def->defname, "recompile") == 0)
+		{
+			if (recompile_set)
+				ereport(ERROR,
+					(errcode(ERRCODE_SYNTAX_ERROR),
+						errmsg("Redundant option: recompile (%s)", defGetString(def))
+					));
+					
+			/* this will throw an error if the value is not a valid boolean */
+			option_set.recompile = defGetBoolean(def);
+			recompile_set = true;
+		}
+		
+		else if (strcmp(def->defname, "table_hints") == 0)
+		{
+			if (option_set.table_hints)
+				ereport(ERROR,
+					(errcode(ERRCODE_SYNTAX_ERROR),
+						errmsg("Redundant option: table_hints (%s)", defGetString(def))
+					));
+					
+			option_set.table_hints = defGetString(def);
+			tdsValidateTableHints(option_set.table_hints);
+		}
+		
+		else if (strcmp(def->defname, "isolation_level") == 0)
+		{
+			if (option_set.isolation_level)
+				ereport(ERROR,
+					(errcode(ERRCODE_SYNTAX_ERROR),
+						errmsg("Redundant option: isolation_level (%s)", defGetString(def))
+					));
+					
+			option_set.isolation_level = defGetString(def);
+			tdsValidateIsolationLevel(option_set.isolation_level);
+		}
+		
+		else if (strcmp(def->defname, "key_column") == 0)
+		{
+			if (option_set.key_column)
+				ereport(ERROR,
+					(errcode(ERRCODE_SYNTAX_ERROR),
+						errmsg("Redundant option: key_column (%s)", defGetString(def))
+					));
+					
+			option_set.key_column = defGetString(def);
+		}
+		
+		else if (strcmp(def->defname, "column_name") == 0)
+		{
+			if (column_name)
+				ereport(ERROR,
+					(errcode(ERRCODE_SYNTAX_ERROR),
+						errmsg("Redundant option: column_name (%s)", defGetString(def))
+					));
+					
+			column_name = defGetString(def);
+		}
+		
+		else if (strcmp(def->defname, "lazy") == 0)
+		{
+			if (lazy_set)
+				ereport(ERROR,
+					(errcode(ERRCODE_SYNTAX_ERROR),
+						errmsg("Redundant option: lazy (%s)", defGetString(def))
+					));
+					
+			/* this will throw an error if the value is not a valid boolean */
+			defGetBoolean(def);
+			lazy_set = true;
+		}
+		
+		else if (strcmp(def->defname, "placeholder") == 0)
+		{
+			if (placeholder)
+				ereport(ERROR,
+					(errcode(ERRCODE_SYNTAX_ERROR),
+						errmsg("Redundant option: placeholder (%s)", defGetString(def))
+					));
+					
+			placeholder = defGetString(def);
+			tdsValidatePlaceholderName(placeholder);
+		}
+		
+		else if (strcmp(def->defname, "placeholder_from") == 0)
+		{
+			if (placeholder_from)
+				ereport(ERROR,
+					(errcode(ERRCODE_SYNTAX_ERROR),
+						errmsg("Redundant option: placeholder_from (%s)", defGetString(def))
+					));
+					
+			placeholder_from = defGetString(def);
+			tdsValidatePlaceholderName(placeholder_from);
+		}
+		
+		else if (strcmp(def->defname, "placeholder_to") == 0)
+		{
+			if (placeholder_to)
+				ereport(ERROR,
+					(errcode(ERRCODE_SYNTAX_ERROR),
+						errmsg("Redundant option: placeholder_to (%s)", defGetString(def))
+					));
+					
+			placeholder_to = defGetString(def);
+			tdsValidatePlaceholderName(placeholder_to);
+		}
 	}
 	
 	#ifdef DEBUG
@@ -406,11 +835,30 @@ static void tdsOptionSetInit(TdsFdwOptionSet* option_set)
 	option_set->language = NULL;
 	option_set->character_set = NULL;
 	option_set->port = 0;
+	option_set->packet_size = 0;
 	option_set->username = NULL;
 	option_set->password = NULL;
 	option_set->database = NULL;
 	option_set->query = NULL;
 	option_set->table = NULL;
+	option_set->compress = false;
+	option_set->derived_table = false;
+	option_set->staging_threshold = -1;
+	option_set->maxdop = -1;
+	option_set->recompile = false;
+	option_set->table_hints = NULL;
+	option_set->isolation_level = NULL;
+	option_set->fetch_size = -1;
+	option_set->text_size = -1;
+	option_set->key_column = NULL;
+	option_set->key_attnum = 0;
+	option_set->ncolumns = 0;
+	option_set->columns = NULL;
+	option_set->nplaceholders = 0;
+	option_set->placeholders = NULL;
+	option_set->dialect.product = TDS_PRODUCT_UNKNOWN;
+	option_set->dialect.major_version = 0;
+	option_set->dialect.tds_version = 0;
 	
 	#ifdef DEBUG
 		ereport(NOTICE,
@@ -500,6 +948,17 @@ static void tdsGetOptions(Oid foreigntableid, TdsFdwOptionSet* option_set)
 			#endif
 		}
 		
+		else if (strcmp(def->defname, "packet_size") == 0)
+		{
+			option_set->packet_size = atoi(defGetString(def));
+			
+			#ifdef DEBUG
+				ereport(NOTICE,
+					(errmsg("Packet size is %i", option_set->packet_size)
+					));
+			#endif
+		}
+		
 		else if (strcmp(def->defname, "username") == 0)
 		{
 			option_set->username = defGetString(def);
@@ -553,1077 +1012,4763 @@ static void tdsGetOptions(Oid foreigntableid, TdsFdwOptionSet* option_set)
 					(errmsg("Table is %s", option_set->table)
 					));
 			#endif
-		}		
-	}
-	
-	/* Default values, if not set */
-	
-	if (!option_set->servername)
-	{
-		if ((option_set->servername = palloc((strlen(DEFAULT_SERVERNAME) + 1) * sizeof(char))) == NULL)
-        	{
-                	ereport(ERROR,
-                        	(errcode(ERRCODE_FDW_OUT_OF_MEMORY),
-                                	errmsg("Failed to allocate memory for connection string")
-                        	));
-        	}
-
-		sprintf(option_set->servername, "%s", DEFAULT_SERVERNAME);
+		}
 		
-		#ifdef DEBUG
-			ereport(NOTICE,
-				(errmsg("Set servername to default: %s", option_set->servername)
-				));
-		#endif
-	}
-	
-	/* Check required options */
-	
-	if (!option_set->table && !option_set->query)
-	{
-		ereport(ERROR,
-			(errcode(ERRCODE_SYNTAX_ERROR),
-				errmsg("Either a table or a query must be specified")
-			));
-	}
-	
-	#ifdef DEBUG
-		ereport(NOTICE,
-			(errmsg("----> finishing tdsGetOptions")
-			));
-	#endif
-}
-
-/* set up connection */
-
-static int tdsSetupConnection(TdsFdwOptionSet* option_set, LOGINREC *login, DBPROCESS **dbproc)
-{
-	char* conn_string;
-	RETCODE erc;
-	
-	#ifdef DEBUG
-		ereport(NOTICE,
-			(errmsg("----> starting tdsSetupConnection")
-			));
-	#endif		
-	
-	#ifdef DEBUG
-		ereport(NOTICE,
-			(errmsg("Setting login user to %s", option_set->username)
-			));
-	#endif
-	
-	DBSETLUSER(login, option_set->username);
-	
-	#ifdef DEBUG
-		ereport(NOTICE,
-			(errmsg("Setting login password to %s", option_set->password)
-			));
-	#endif
-	
-	DBSETLPWD(login, option_set->password);	
+		else if (strcmp(def->defname, "compress") == 0)
+		{
+			option_set->compress = defGetBoolean(def);
+			
+			#ifdef DEBUG
+				ereport(NOTICE,
+					(errmsg("Compress is %i", option_set->compress)
+					));
+			#endif
+		}
+		
+		else if (strcmp(def->defname, "derived_table") == 0)
+		{
+			option_set->derived_table = defGetBoolean(def);
+			
+			#ifdef DEBUG
+				ereport(NOTICE,
+					(errmsg("Derived table is %i", option_set->derived_table)
+					));
+			#endif
+		}
+		
+		/* the options of the table come first, and they override the ones of the server */
+		else if (strcmp(def->defname, "staging_threshold") == 0 && option_set->staging_threshold < 0)
+		{
+			option_set->staging_threshold = atoi(defGetString(def));
+			
+			#ifdef DEBUG
+				ereport(NOTICE,
+					(errmsg("Staging threshold is %i", option_set->staging_threshold)
+					));
+			#endif
+		}
+		
+		else if (strcmp(def->defname, "maxdop") == 0 && option_set->maxdop < 0)
+		{
+			option_set->maxdop = atoi(defGetString(def));
+			
+			#ifdef DEBUG
+				ereport(NOTICE,
+					(errmsg("Maxdop is %i", option_set->maxdop)
+					));
+			#endif
+		}
+		
+		else if (strcmp(def->defname, "fetch_size") == 0 && option_set->fetch_size < 0)
+		{
+			option_set->fetch_size = atoi(defGetString(def));
+			
+			#ifdef DEBUG
+				ereport(NOTICE,
+					(errmsg("Fetch size is %i", option_set->fetch_size)
+					));
+			#endif
+		}
+		
+		else if (strcmp(def->defname, "text_size") == 0 && option_set->text_size < 0)
+		{
+			option_set->text_size = atoi(defGetString(def));
+			
+			#ifdef DEBUG
+				ereport(NOTICE,
+					(errmsg("Text size is %i", option_set->text_size)
+					));
+			#endif
+		}
+		
+		else if (strcmp(def->defname, "recompile") == 0)
+		{
+			option_set->recompile = defGetBoolean(def);
+			
+			#ifdef DEBUG
+				ereport(NOTICE,
+					(errmsg("Recompile is %i", option_set->recompile)
+					));
+			#endif
+		}
+		
+		else if (strcmp(def->defname, "table_hints") == 0 && !option_set->table_hints)
+		{
+			option_set->table_hints = defGetString(def);
+			
+			#ifdef DEBUG
+				ereport(NOTICE,
+					(errmsg("Table hints are %s", option_set->table_hints)
+					));
+			#endif
+		}
+		
+		else if (strcmp(def->defname, "isolation_level") == 0 && !option_set->isolation_level)
+		{
+			option_set->isolation_level = defGetString(def);
+			
+			#ifdef DEBUG
+				ereport(NOTICE,
+					(errmsg("Isolation level is %s", option_set->isolation_level)
+					));
+			#endif
+		}
+		
+		else if (strcmp(def->defname, "key_column") == 0)
+		{
+			option_set->key_column = defGetString(def);
+			
+			#ifdef DEBUG
+				ereport(NOTICE,
+					(errmsg("Key column is %s", option_set->key_column)
+					));
+			#endif
+		}
+	}
 	
-	if (option_set->character_set)
-	{
-		#ifdef DEBUG
-			ereport(NOTICE,
-				(errmsg("Setting login character set to %s", option_set->character_set)
-				));
-		#endif
+	tdsGetColumnOptions(foreigntableid, option_set);
 	
-		DBSETLCHARSET(login, option_set->character_set);
-	}
+	/* Default values, if not set */
 	
-	if (option_set->language)
+	if (!option_set->servername)
 	{
-		DBSETLNATLANG(login, option_set->language);
+		if ((option_set->servername = palloc((strlen(DEFAULT_SERVERNAME) + 1) * sizeof(char))) == NULL)
+        	{
+                	ereport(ERROR,
+                        	(errcode(ERRCODE_FDW_OUT_OF_MEMORY),
+                                	errmsg("Failed to allocate memory for connection string")
+                        	));
+        	}
+
+		sprintf(option_set->servername, "%s", DEFAULT_SERVERNAME);
 		
 		#ifdef DEBUG
 			ereport(NOTICE,
-				(errmsg("Setting login language to %s", option_set->language)
+				(errmsg("Set servername to default: %s", option_set->servername)
 				));
 		#endif
 	}
 	
-	if ((conn_string = palloc((strlen(option_set->servername) + 10) * sizeof(char))) == NULL)
+	if (option_set->staging_threshold < 0)
 	{
-		ereport(ERROR,
-			(errcode(ERRCODE_FDW_OUT_OF_MEMORY),
-				errmsg("Failed to allocate memory for connection string")
-			));
-			
-		return -1;
+		option_set->staging_threshold = 0;
 	}
 	
-	if (option_set->port)
+	if (option_set->fetch_size < 0)
 	{
-		sprintf(conn_string, "%s:%i", option_set->servername, option_set->port);
+		option_set->fetch_size = tds_fdw_fetch_size;
 	}
 	
-	else
+	if (option_set->text_size < 0)
 	{
-		sprintf(conn_string, "%s", option_set->servername);
+		option_set->text_size = DEFAULT_TEXT_SIZE;
 	}
 	
-	#ifdef DEBUG
-		ereport(NOTICE,
-			(errmsg("Connection string is %s", conn_string)
-			));
-		ereport(NOTICE,
-			(errmsg("Connecting to server")
-			));
-	#endif
+	/* the foreign server may already be known from an earlier connection */
+	tdsGetDialect(option_set, NULL);
 	
-	if ((*dbproc = dbopen(login, conn_string)) == NULL)
+	/* Check required options */
+	
+	if (!option_set->table && !option_set->query)
 	{
 		ereport(ERROR,
-			(errcode(ERRCODE_FDW_UNABLE_TO_ESTABLISH_CONNECTION),
-				errmsg("Failed to connect using connection string %s with user %s", conn_string, option_set->username)
+			(errcode(ERRCODE_SYNTAX_ERROR),
+				errmsg("Either a table or a query must be specified")
 			));
-			
-		return -1;
 	}
 	
 	#ifdef DEBUG
 		ereport(NOTICE,
-			(errmsg("Connected successfully")
+			(errmsg("----> finishing tdsGetOptions")
 			));
 	#endif
-	
-	pfree(conn_string);
-	
-	if (option_set->database)
-	{
-		#ifdef DEBUG
-			ereport(NOTICE,
-				(errmsg("Selecting database %s", option_set->database)
-				));
-		#endif
-		
-		if ((erc = dbuse(*dbproc, option_set->database)) == FAIL)
-		{
-			ereport(ERROR,
-				(errcode(ERRCODE_FDW_UNABLE_TO_ESTABLISH_CONNECTION),
-					errmsg("Failed to select database %s", option_set->database)
-				));
-				
-			return -1;
-		}
-		
-		#ifdef DEBUG
-			ereport(NOTICE,
-				(errmsg("Selected database")
-				));
-		#endif
-	}
+}
+
+/* get options for the columns of a FOREIGN TABLE */
+
+static void tdsGetColumnOptions(Oid foreigntableid, TdsFdwOptionSet* option_set)
+{
+	Relation rel;
+	TupleDesc tupdesc;
+	int i;
 	
 	#ifdef DEBUG
 		ereport(NOTICE,
-			(errmsg("Getting query")
+			(errmsg("----> starting tdsGetColumnOptions")
 			));
 	#endif
 	
-	if (option_set->query)
+	rel = heap_open(foreigntableid, NoLock);
+	tupdesc = RelationGetDescr(rel);
+	
+	option_set->ncolumns = tupdesc->natts;
+	
+	if ((option_set->columns = palloc0(tupdesc->natts * sizeof(TdsFdwColumnOption))) == NULL)
 	{
-		#ifdef DEBUG
-			ereport(NOTICE,
-				(errmsg("Query is explicitly set")
-				));
-		#endif
+		ereport(ERROR,
+			(errcode(ERRCODE_FDW_OUT_OF_MEMORY),
+				errmsg("Failed to allocate memory for column options")
+			));
 	}
 	
-	else
+	for (i = 0; i < tupdesc->natts; i++)
 	{
-		size_t len;
-		static const char *query_prefix = "SELECT * FROM ";
+		Form_pg_attribute attr = tupdesc->attrs[i];
+		TdsFdwColumnOption *column = &option_set->columns[i];
 		
-		#ifdef DEBUG
-			ereport(NOTICE,
-				(errmsg("Building query using table")
-				));
-		#endif
+		if (attr->attisdropped)
+			continue;
+		
+		/* the table-level setting only applies to columns that can hold the result */
+		column->compress = option_set->compress && tdsIsCompressibleType(attr->atttypid);
 		
-		len = strlen(query_prefix) + strlen(option_set->table) + 1;
+		/* column options were added in 9.2.0 */
+		#if (PG_VERSION_NUM >= 90200)
+		{
+			List *options = GetForeignColumnOptions(foreigntableid, attr->attnum);
+			ListCell *lc;
+			
+			foreach (lc, options)
+			{
+				DefElem *def = (DefElem *) lfirst(lc);
+				
+				if (strcmp(def->defname, "column_name") == 0)
+				{
+					column->column_name = defGetString(def);
+					
+					#ifdef DEBUG
+						ereport(NOTICE,
+							(errmsg("Column name of %s is %s", NameStr(attr->attname), column->column_name)
+							));
+					#endif
+				}
+				
+				else if (strcmp(def->defname, "compress") == 0)
+				{
+					column->compress = defGetBoolean(def);
+					
+					if (column->compress && !tdsIsCompressibleType(attr->atttypid))
+					{
+						ereport(ERROR,
+							(errcode(ERRCODE_FDW_INVALID_DATA_TYPE),
+								errmsg("Column %s cannot be compressed", NameStr(attr->attname)),
+								errhint("Only text, varchar, char and bytea columns can be compressed")
+							));
+					}
+				}
+				
+				else if (strcmp(def->defname, "lazy") == 0)
+				{
+					column->lazy = defGetBoolean(def);
+				}
+				
+				else if (strcmp(def->defname, "placeholder") == 0)
+				{
+					column->placeholder = defGetString(def);
+				}
+				
+				else if (strcmp(def->defname, "placeholder_from") == 0)
+				{
+					column->placeholder_from = defGetString(def);
+				}
+				
+				else if (strcmp(def->defname, "placeholder_to") == 0)
+				{
+					column->placeholder_to = defGetString(def);
+				}
+			}
+			
+			if ((column->placeholder || column->placeholder_from || column->placeholder_to) &&
+				!tdsGetParameterType(attr->atttypid, NULL))
+			{
+				ereport(ERROR,
+					(errcode(ERRCODE_FDW_INVALID_DATA_TYPE),
+						errmsg("Column %s cannot be bound to a placeholder", NameStr(attr->attname)),
+						errhint("Only boolean, integer, floating-point, date, timestamp, text, varchar and char columns can be bound to placeholders")
+					));
+			}
+		}
+		#endif
 		
-		if ((option_set->query = palloc(len * sizeof(char))) == NULL)
+		if (option_set->key_column && strcmp(NameStr(attr->attname), option_set->key_column) == 0)
+			option_set->key_attnum = attr->attnum;
+	}
+	
+	if (option_set->key_column)
+	{
+		if (!option_set->key_attnum)
 		{
 			ereport(ERROR,
-				(errcode(ERRCODE_FDW_OUT_OF_MEMORY),
-					errmsg("Failed to allocate memory for query")
+				(errcode(ERRCODE_FDW_COLUMN_NAME_NOT_FOUND),
+					errmsg("Key column %s does not exist", option_set->key_column)
 				));
-				
-			return -1;
 		}
 		
-		if (snprintf(option_set->query, len, "%s%s", query_prefix, option_set->table) < 0)
+		if (!tdsIsPushableType(tupdesc->attrs[option_set->key_attnum - 1]->atttypid))
 		{
 			ereport(ERROR,
-				(errcode(ERRCODE_FDW_OUT_OF_MEMORY),
-					errmsg("Failed to build query")
+				(errcode(ERRCODE_FDW_INVALID_DATA_TYPE),
+					errmsg("Column %s cannot be used as the key column", option_set->key_column),
+					errhint("Only boolean, integer, numeric, floating-point, date, timestamp, text, varchar and char columns can be used as the key column")
 				));
-				
-			return -1;
 		}
 	}
 	
-	#ifdef DEBUG
-		ereport(NOTICE,
-			(errmsg("Value of query is %s", option_set->query)
-			));
-	#endif
+	if (option_set->query)
+	{
+		tdsGetPlaceholders(tupdesc, option_set);
+	}
+	
+	heap_close(rel, NoLock);
 	
 	#ifdef DEBUG
 		ereport(NOTICE,
-			(errmsg("----> finishing tdsSetupConnection")
+			(errmsg("----> finishing tdsGetColumnOptions")
 			));
-	#endif	
-	
-	return 0;
+	#endif
 }
 
-/* get the number of rows returned by a query */
+/* check the name of a placeholder given in a column option */
 
-static int tdsGetRowCount(TdsFdwOptionSet* option_set, LOGINREC *login, DBPROCESS *dbproc)
+static void tdsValidatePlaceholderName(const char *name)
 {
-	int rows_report = 0;
-	int rows_increment = 0;
-	RETCODE erc;
-	int ret_code;
-	
-	#ifdef DEBUG
-		ereport(NOTICE,
-			(errmsg("----> starting tdsGetRowCount")
-			));
-	#endif		
-	
-	#ifdef DEBUG
-		ereport(NOTICE,
-			(errmsg("Setting database command to %s", option_set->query)
+	if (!tdsIsPlaceholderName(name))
+	{
+		ereport(ERROR,
+			(errcode(ERRCODE_FDW_INVALID_STRING_FORMAT),
+				errmsg("Invalid placeholder name: %s", name),
+				errhint("Placeholder names may only contain letters, digits and underscores, and may not start with a digit")
 			));
-	#endif
+	}
+}
+
+/* table hints are written into the query as they are, so only hint syntax is allowed */
+
+static void tdsValidateTableHints(const char *table_hints)
+{
+	const char *ch;
 	
-	if ((erc = dbcmd(dbproc, option_set->query)) == FAIL)
+	for (ch = table_hints; *ch; ch++)
 	{
-		ereport(ERROR,
-			(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
-				errmsg("Failed to set current query to %s", option_set->query)
-			));		
+		if (!isalnum((unsigned char) *ch) && !strchr("_, ()=", *ch))
+		{
+			ereport(ERROR,
+				(errcode(ERRCODE_FDW_INVALID_STRING_FORMAT),
+					errmsg("Invalid table hints: %s", table_hints),
+					errhint("Table hints may only contain letters, digits, underscores, commas, spaces, parentheses and equal signs, e.g. NOLOCK or READPAST, INDEX(1)")
+				));
+		}
+	}
+}
 
-		goto cleanup;
+/* the isolation levels that can be set with SET TRANSACTION ISOLATION LEVEL */
+
+static void tdsValidateIsolationLevel(const char *isolation_level)
+{
+	static const char *isolation_levels[] = {
+		"read uncommitted", "read committed", "repeatable read", "snapshot", "serializable", NULL
+	};
+	int i;
+	
+	for (i = 0; isolation_levels[i]; i++)
+	{
+		if (pg_strcasecmp(isolation_level, isolation_levels[i]) == 0)
+			return;
 	}
 	
+	ereport(ERROR,
+		(errcode(ERRCODE_FDW_INVALID_ATTRIBUTE_VALUE),
+			errmsg("Invalid isolation level: %s", isolation_level),
+			errhint("Valid isolation levels are: read uncommitted, read committed, repeatable read, snapshot, serializable")
+		));
+}
+
+/* find the placeholders in the query, and the types of the columns that they are bound to */
+
+static void tdsGetPlaceholders(TupleDesc tupdesc, TdsFdwOptionSet* option_set)
+{
+	List *names = tdsGetPlaceholderNames(option_set->query);
+	ListCell *lc;
+	int i = 0;
+	
 	#ifdef DEBUG
 		ereport(NOTICE,
-			(errmsg("Executing the query")
+			(errmsg("----> starting tdsGetPlaceholders")
 			));
 	#endif
 	
-	if ((erc = dbsqlexec(dbproc)) == FAIL)
+	option_set->nplaceholders = list_length(names);
+	
+	if (option_set->nplaceholders == 0)
 	{
-		ereport(ERROR,
-			(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
-				errmsg("Failed to execute query %s", option_set->query)
-			));	
-
 		goto cleanup;
 	}
-
-	#ifdef DEBUG
-		ereport(NOTICE,
-			(errmsg("Query executed correctly")
-			));
-		ereport(NOTICE,
-			(errmsg("Getting results")
-			));				
-	#endif
-
-	erc = dbresults(dbproc);
 	
-	if (erc == FAIL)
+	if ((option_set->placeholders = palloc0(option_set->nplaceholders * sizeof(TdsFdwParameter))) == NULL)
 	{
 		ereport(ERROR,
-			(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
-				errmsg("Failed to get results from query %s", option_set->query)
+			(errcode(ERRCODE_FDW_OUT_OF_MEMORY),
+				errmsg("Failed to allocate memory for placeholders")
 			));
-			
-		goto cleanup;
 	}
 	
-	else if (erc == NO_MORE_RESULTS)
+	foreach (lc, names)
 	{
-		#ifdef DEBUG
-			ereport(NOTICE,
-				(errmsg("There appears to be no results from query %s", option_set->query)
-				));
-		#endif
+		TdsFdwParameter *placeholder = &option_set->placeholders[i++];
+		int attnum;
 		
-		goto cleanup;
-	}
-	
-	else if (erc == SUCCEED)
-	{
-		#ifdef DEBUG
-			ereport(NOTICE,
-				(errmsg("Successfully got results")
-				));
-		#endif
+		placeholder->name = (char *) lfirst(lc);
+		placeholder->typid = InvalidOid;
+		placeholder->isnull = true;
 		
-		if ((ret_code = dbnextrow(dbproc)) != NO_MORE_ROWS)
+		for (attnum = 1; attnum <= option_set->ncolumns; attnum++)
 		{
-			switch (ret_code)
+			TdsFdwColumnOption *column = &option_set->columns[attnum - 1];
+			
+			if ((column->placeholder && strcmp(column->placeholder, placeholder->name) == 0) ||
+				(column->placeholder_from && strcmp(column->placeholder_from, placeholder->name) == 0) ||
+				(column->placeholder_to && strcmp(column->placeholder_to, placeholder->name) == 0))
 			{
-				case REG_ROW:
-					rows_increment++;
-					break;
-					
-				case BUF_FULL:
-					ereport(ERROR,
-						(errcode(ERRCODE_FDW_OUT_OF_MEMORY),
-							errmsg("Buffer filled up while getting plan for query")
-						));					
-
-					goto cleanup;
-						
-				case FAIL:
-					ereport(ERROR,
-						(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
-							errmsg("Failed to get row while getting plan for query")
-						));				
-
-					goto cleanup;
-				
-				default:
-					ereport(ERROR,
-						(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
-							errmsg("Failed to get plan for query. Unknown return code.")
-						));					
-
-					goto cleanup;
+				placeholder->typid = tupdesc->attrs[attnum - 1]->atttypid;
+				break;
 			}
 		}
 		
-		rows_report = DBCOUNT(dbproc);
+		if (placeholder->typid == InvalidOid)
+		{
+			ereport(ERROR,
+				(errcode(ERRCODE_FDW_OPTION_NAME_NOT_FOUND),
+					errmsg("Placeholder {{%s}} in query is not bound to a column", placeholder->name),
+					errhint("Set the placeholder, placeholder_from or placeholder_to option of a column to %s", placeholder->name)
+				));
+		}
 		
 		#ifdef DEBUG
 			ereport(NOTICE,
-				(errmsg("We counted %i rows, and dbcount says %i rows", rows_increment, rows_report)
+				(errmsg("Placeholder %s has type %u", placeholder->name, placeholder->typid)
 				));
-		#endif		
+		#endif
 	}
 	
-	else
-	{
-		ereport(ERROR,
-			(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
-				errmsg("Unknown return code getting results from query %s", option_set->query)
-			));		
-	}
+cleanup:
+	;
 	
-cleanup:	
 	#ifdef DEBUG
 		ereport(NOTICE,
-			(errmsg("----> finishing tdsGetRowCount")
+			(errmsg("----> finishing tdsGetPlaceholders")
 			));
-	#endif		
-	
-	return rows_report;
+	#endif
 }
 
-/* get the startup cost for the query */
+/* set up connection */
 
-static int tdsGetStartupCost(TdsFdwOptionSet* option_set)
+static int tdsSetupConnection(TdsFdwOptionSet* option_set, LOGINREC *login, DBPROCESS **dbproc)
 {
-	int startup_cost;
+	char* conn_string;
+	RETCODE erc;
 	
 	#ifdef DEBUG
 		ereport(NOTICE,
-			(errmsg("----> starting tdsGetStartupCost")
+			(errmsg("----> starting tdsSetupConnection")
 			));
-	#endif	
+	#endif		
 	
-	if (strcmp(option_set->servername, "127.0.0.1") == 0 || strcmp(option_set->servername, "localhost") == 0)
-		startup_cost = 0;
-	else
-		startup_cost = 25;
-		
 	#ifdef DEBUG
 		ereport(NOTICE,
-			(errmsg("----> finishing tdsGetStartupCost")
+			(errmsg("Setting login user to %s", option_set->username)
 			));
-	#endif		
-		
-	return startup_cost;
-}
-
-static char* tdsConvertToCString(DBPROCESS* dbproc, int srctype, const BYTE* src, DBINT srclen)
-{
-	char* dest = NULL;
-	int real_destlen;
-	DBINT destlen;
-	int desttype;
-	int ret_value;
+	#endif
 	
-	switch(srctype)
-	{
-		case SYBCHAR:
-		case SYBVARCHAR:
-		case SYBTEXT:
-			real_destlen = srclen + 1; /* the size of the array */
-			destlen = -1; /* the size to pass to dbconvert (-1 means to null terminate it) */
-			desttype = SYBCHAR;
-			break;
-		case SYBBINARY:
-		case SYBVARBINARY:
-			real_destlen = srclen;
-			destlen = srclen;
-			desttype = SYBBINARY;
-			break;
-		default:
-			real_destlen = 1000; /* Probably big enough */
-			destlen = -1; 
-			desttype = SYBCHAR;
-			break;
-	}
+	DBSETLUSER(login, option_set->username);
 	
 	#ifdef DEBUG
 		ereport(NOTICE,
-			(errmsg("Source type is %i. Destination type is %i", srctype, desttype)
-			));
-		ereport(NOTICE,
-			(errmsg("Source length is %i. Destination length is %i. Real destination length is %i", srclen, destlen, real_destlen)
+			(errmsg("Setting login password to %s", option_set->password)
 			));
-	#endif	
+	#endif
 	
-	if (dbwillconvert(srctype, desttype) != FALSE)
+	DBSETLPWD(login, option_set->password);	
+	
+	if (option_set->character_set)
 	{
-		if ((dest = palloc(real_destlen * sizeof(char))) == NULL)
-		{
-			ereport(ERROR,
-				(errcode(ERRCODE_FDW_OUT_OF_MEMORY),
-				errmsg("Failed to allocate memory for column value")
+		#ifdef DEBUG
+			ereport(NOTICE,
+				(errmsg("Setting login character set to %s", option_set->character_set)
 				));
-		}
-		
-		ret_value = dbconvert(dbproc, srctype, src, srclen, desttype, (BYTE *) dest, destlen);
-		
-		if (ret_value == FAIL)
-		{
-			#ifdef DEBUG
-				ereport(NOTICE,
-					(errmsg("Failed to convert column")
-					));
-			#endif	
-		}
-		
-		else if (ret_value == -1)
-		{
-			#ifdef DEBUG
-				ereport(NOTICE,
-					(errmsg("Failed to convert column. Could have been a NULL pointer or bad data type.")
-					));
-			#endif	
-		}
+		#endif
+	
+		DBSETLCHARSET(login, option_set->character_set);
 	}
 	
-	else
+	if (option_set->language)
 	{
+		DBSETLNATLANG(login, option_set->language);
+		
 		#ifdef DEBUG
 			ereport(NOTICE,
-				(errmsg("Column cannot be converted to this type.")
+				(errmsg("Setting login language to %s", option_set->language)
 				));
 		#endif
 	}
 	
-	return dest;
+	/* larger packets mean fewer reads for the rows of large results */
+	if (option_set->packet_size)
+	{
+		DBSETLPACKET(login, option_set->packet_size);
+		
+		#ifdef DEBUG
+			ereport(NOTICE,
+				(errmsg("Setting login packet size to %i", option_set->packet_size)
+				));
+		#endif
+	}
 	
-}
-
-/* get output for EXPLAIN */
-
-static void tdsExplainForeignScan(ForeignScanState *node, ExplainState *es)
-{
-	#ifdef DEBUG
-		ereport(NOTICE,
-			(errmsg("----> starting tdsExplainForeignScan")
+	if ((conn_string = palloc((strlen(option_set->servername) + 10) * sizeof(char))) == NULL)
+	{
+		ereport(ERROR,
+			(errcode(ERRCODE_FDW_OUT_OF_MEMORY),
+				errmsg("Failed to allocate memory for connection string")
 			));
-	#endif
+			
+		return -1;
+	}
 	
-	#ifdef DEBUG
-		ereport(NOTICE,
-			(errmsg("----> finishing tdsExplainForeignScan")
-			));
-	#endif
-}
-
-/* initiate access to foreign server and database */
-
-static void tdsBeginForeignScan(ForeignScanState *node, int eflags)
-{
-	TdsFdwOptionSet option_set;
-	LOGINREC *login;
-	DBPROCESS *dbproc;
-	TdsFdwExecutionState *festate;
-	
-	#ifdef DEBUG
-		ereport(NOTICE,
-			(errmsg("----> starting tdsBeginForeignScan")
-			));
-	#endif
-	
-	tdsGetOptions(RelationGetRelid(node->ss.ss_currentRelation), &option_set);
-		
-	#ifdef DEBUG
-		ereport(NOTICE,
-			(errmsg("Initiating DB-Library")
-			));
-	#endif
-	
-	if (dbinit() == FAIL)
+	if (option_set->port)
 	{
-		ereport(ERROR,
-			(errcode(ERRCODE_FDW_OUT_OF_MEMORY),
-				errmsg("Failed to initialize DB-Library environment")
-			));
+		sprintf(conn_string, "%s:%i", option_set->servername, option_set->port);
 	}
 	
-	dberrhandle(tds_err_handler);
-	dbmsghandle(tds_msg_handler);
+	else
+	{
+		sprintf(conn_string, "%s", option_set->servername);
+	}
 	
 	#ifdef DEBUG
 		ereport(NOTICE,
-			(errmsg("Getting login structure")
+			(errmsg("Connection string is %s", conn_string)
 			));
-	#endif
-	
-	if ((login = dblogin()) == NULL)
-	{
-		ereport(ERROR,
-			(errcode(ERRCODE_FDW_OUT_OF_MEMORY),
-				errmsg("Failed to initialize DB-Library login structure")
+		ereport(NOTICE,
+			(errmsg("Connecting to server")
 			));
-	}
-	
-	if (tdsSetupConnection(&option_set, login, &dbproc) != 0)
-	{
-		goto cleanup;
-	}
+	#endif
 	
-	if ((festate = (TdsFdwExecutionState *) palloc(sizeof(TdsFdwExecutionState))) == NULL)
+	if ((*dbproc = dbopen(login, conn_string)) == NULL)
 	{
 		ereport(ERROR,
-			(errcode(ERRCODE_FDW_OUT_OF_MEMORY),
-				errmsg("Failed to allocate memory for execution state")
+			(errcode(ERRCODE_FDW_UNABLE_TO_ESTABLISH_CONNECTION),
+				errmsg("Failed to connect using connection string %s with user %s", conn_string, option_set->username)
 			));
+			
+		return -1;
 	}
 	
-	node->fdw_state = (void *) festate;
-	festate->login = login;
-	festate->dbproc = dbproc;
-	festate->query = option_set.query;
-	festate->first = 1;
-	festate->row = 0;
-	
-cleanup:
-	;
-	
 	#ifdef DEBUG
 		ereport(NOTICE,
-			(errmsg("----> finishing tdsBeginForeignScan")
+			(errmsg("Connected successfully")
 			));
 	#endif
-}
-
-/* get next row from foreign table */
-
-static TupleTableSlot* tdsIterateForeignScan(ForeignScanState *node)
-{
-	RETCODE erc;
-	int ret_code;
-	HeapTuple tuple;
-	TdsFdwExecutionState *festate = (TdsFdwExecutionState *) node->fdw_state;
-	TupleTableSlot *slot = node->ss.ss_ScanTupleSlot;
-	
-	/* Cleanup */
-	ExecClearTuple(slot);
 	
-	#ifdef DEBUG
-		ereport(NOTICE,
-			(errmsg("----> starting tdsIterateForeignScan")
-			));
-	#endif
+	pfree(conn_string);
 	
-	if (festate->first)
+	if (option_set->database)
 	{
 		#ifdef DEBUG
 			ereport(NOTICE,
-				(errmsg("This is the first iteration")
-				));
-			ereport(NOTICE,
-				(errmsg("Setting database command to %s", festate->query)
+				(errmsg("Selecting database %s", option_set->database)
 				));
 		#endif
 		
-		festate->first = 0;
-		
-		if ((erc = dbcmd(festate->dbproc, festate->query)) == FAIL)
+		if ((erc = dbuse(*dbproc, option_set->database)) == FAIL)
 		{
 			ereport(ERROR,
-				(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
-					errmsg("Failed to set current query to %s", festate->query)
+				(errcode(ERRCODE_FDW_UNABLE_TO_ESTABLISH_CONNECTION),
+					errmsg("Failed to select database %s", option_set->database)
 				));
+				
+			return -1;
 		}
 		
 		#ifdef DEBUG
 			ereport(NOTICE,
-				(errmsg("Executing the query")
+				(errmsg("Selected database")
 				));
 		#endif
+	}
+	
+	tdsGetDialect(option_set, *dbproc);
+	
+	/*
+	 * This is sent right away, since dbsetopt() would only send it with the
+	 * next batch of SQL, and a query that is sent as a remote procedure call
+	 * would miss it.
+	 */
+	if (option_set->text_size > 0)
+	{
+		StringInfoData sql;
+		
+		initStringInfo(&sql);
+		appendStringInfo(&sql, "SET TEXTSIZE %d", option_set->text_size);
 		
-		if ((erc = dbsqlexec(festate->dbproc)) == FAIL)
-		{
-			ereport(ERROR,
-				(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
-					errmsg("Failed to execute query %s", festate->query)
-				));
-		}
-
 		#ifdef DEBUG
 			ereport(NOTICE,
-				(errmsg("Query executed correctly")
+				(errmsg("Setting text size to %i", option_set->text_size)
 				));
-			ereport(NOTICE,
-				(errmsg("Getting results")
-				));				
 		#endif
-
-		erc = dbresults(festate->dbproc);
 		
-		if (erc == FAIL)
+		if (dbcmd(*dbproc, sql.data) == FAIL || dbsqlexec(*dbproc) == FAIL)
 		{
 			ereport(ERROR,
-				(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
-					errmsg("Failed to get results from query %s", festate->query)
+				(errcode(ERRCODE_FDW_UNABLE_TO_ESTABLISH_CONNECTION),
+					errmsg("Failed to set text size to %i", option_set->text_size)
 				));
+				
+			return -1;
 		}
 		
-		else if (erc == NO_MORE_RESULTS)
+		while ((erc = dbresults(*dbproc)) != NO_MORE_RESULTS)
+		{
+			if (erc == FAIL)
+			{
+				ereport(ERROR,
+					(errcode(ERRCODE_FDW_UNABLE_TO_ESTABLISH_CONNECTION),
+						errmsg("Failed to set text size to %i", option_set->text_size)
+					));
+					
+				return -1;
+			}
+		}
+	}
+	
+	if (option_set->isolation_level)
+	{
+		StringInfoData sql;
+		
+		initStringInfo(&sql);
+		appendStringInfo(&sql, "SET TRANSACTION ISOLATION LEVEL %s", option_set->isolation_level);
+		
+		#ifdef DEBUG
+			ereport(NOTICE,
+				(errmsg("Setting isolation level to %s", option_set->isolation_level)
+				));
+		#endif
+		
+		if (dbcmd(*dbproc, sql.data) == FAIL || dbsqlexec(*dbproc) == FAIL)
 		{
 			ereport(ERROR,
-				(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
-					errmsg("There appears to be no results from query %s", festate->query)
+				(errcode(ERRCODE_FDW_UNABLE_TO_ESTABLISH_CONNECTION),
+					errmsg("Failed to set isolation level to %s", option_set->isolation_level)
 				));
+				
+			return -1;
 		}
 		
-		else if (erc == SUCCEED)
+		while ((erc = dbresults(*dbproc)) != NO_MORE_RESULTS)
 		{
-			#ifdef DEBUG
-				ereport(NOTICE,
-					(errmsg("Successfully got results")
+			if (erc == FAIL)
+			{
+				ereport(ERROR,
+					(errcode(ERRCODE_FDW_UNABLE_TO_ESTABLISH_CONNECTION),
+						errmsg("Failed to set isolation level to %s", option_set->isolation_level)
 					));
-			#endif
+					
+				return -1;
+			}
 		}
+	}
+	
+	#ifdef DEBUG
+		ereport(NOTICE,
+			(errmsg("----> finishing tdsSetupConnection")
+			));
+	#endif	
+	
+	return 0;
+}
+
+/*
+ * Find what the foreign server is, so that the SQL can be written for it. This
+ * is done once per server in a backend, with the first connection to it. Without
+ * a connection, only what is already known is used.
+ */
+
+static void tdsGetDialect(TdsFdwOptionSet* option_set, DBPROCESS *dbproc)
+{
+	TdsFdwDialectCacheEntry *entry;
+	MemoryContext oldcontext;
+	char *version = NULL;
+	RETCODE erc;
+	int ret_code;
+	ListCell *lc;
+	
+	foreach (lc, dialect_cache)
+	{
+		entry = (TdsFdwDialectCacheEntry *) lfirst(lc);
 		
-		else
+		if (strcmp(entry->servername, option_set->servername) == 0 && entry->port == option_set->port)
+		{
+			option_set->dialect = entry->dialect;
+			return;
+		}
+	}
+	
+	if (!dbproc)
+		return;
+	
+	#ifdef DEBUG
+		ereport(NOTICE,
+			(errmsg("----> starting tdsGetDialect")
+			));
+	#endif
+	
+	option_set->dialect.tds_version = dbtds(dbproc);
+	
+	/* @@version works on every version of SQL Server and Sybase ASE, unlike SERVERPROPERTY() */
+	if (dbcmd(dbproc, "SELECT @@version") == FAIL || dbsqlexec(dbproc) == FAIL)
+	{
+		ereport(ERROR,
+			(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
+				errmsg("Failed to get the version of the foreign server")
+			));
+	}
+	
+	while ((erc = dbresults(dbproc)) != NO_MORE_RESULTS)
+	{
+		if (erc == FAIL)
 		{
 			ereport(ERROR,
 				(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
-					errmsg("Unknown return code getting results from query %s", festate->query)
+					errmsg("Failed to get the version of the foreign server")
 				));
 		}
+		
+		while ((ret_code = dbnextrow(dbproc)) != NO_MORE_ROWS)
+		{
+			if (ret_code == REG_ROW && !version && dbdata(dbproc, 1))
+				version = tdsConvertToCString(dbproc, dbcoltype(dbproc, 1), dbdata(dbproc, 1), dbdatlen(dbproc, 1));
+		}
 	}
 	
+	if (version)
+		tdsParseVersion(version, &option_set->dialect);
+	
+	/* only Sybase speaks TDS 5.0 */
+	if (option_set->dialect.product == TDS_PRODUCT_UNKNOWN && option_set->dialect.tds_version == DBTDS_5_0)
+		option_set->dialect.product = TDS_PRODUCT_SYBASE;
+	
+	oldcontext = MemoryContextSwitchTo(TopMemoryContext);
+	entry = (TdsFdwDialectCacheEntry *) palloc(sizeof(TdsFdwDialectCacheEntry));
+	entry->servername = pstrdup(option_set->servername);
+	entry->port = option_set->port;
+	entry->dialect = option_set->dialect;
+	dialect_cache = lappend(dialect_cache, entry);
+	MemoryContextSwitchTo(oldcontext);
+	
 	#ifdef DEBUG
 		ereport(NOTICE,
-			(errmsg("Fetching next row")
+			(errmsg("Foreign server is product %i, version %i, with TDS version %i",
+				option_set->dialect.product, option_set->dialect.major_version, option_set->dialect.tds_version)
+			));
+		ereport(NOTICE,
+			(errmsg("----> finishing tdsGetDialect")
 			));
 	#endif
+}
+
+/*
+ * Get the product and major version from @@version, which looks like
+ * "Microsoft SQL Server 2016 (SP1) - 13.0.4001.0 ..." or
+ * "Adaptive Server Enterprise/15.7/EBF 21341 SMP SP101/...".
+ */
+
+static void tdsParseVersion(const char *version, TdsFdwDialect *dialect)
+{
+	const char *ch;
 	
-	if ((ret_code = dbnextrow(festate->dbproc)) != NO_MORE_ROWS)
+	if (strncmp(version, "Microsoft SQL", strlen("Microsoft SQL")) == 0)
 	{
-		int ncols, ncol;
-		char **values;
+		dialect->product = TDS_PRODUCT_SQLSERVER;
 		
-		switch (ret_code)
-		{
-			case REG_ROW:
-				festate->row++;
-				
-				#ifdef DEBUG
-					ereport(NOTICE,
-						(errmsg("Row %i fetched", festate->row)
-						));
-				#endif
-				
-				ncols = dbnumcols(festate->dbproc);
-				
-				#ifdef DEBUG
-					ereport(NOTICE,
-						(errmsg("%i columns", ncols)
-						));
-				#endif
-				
-				if ((values = palloc(ncols * sizeof(char *))) == NULL)
-				{
-					ereport(ERROR,
-						(errcode(ERRCODE_FDW_OUT_OF_MEMORY),
-						errmsg("Failed to allocate memory for column array")
-						));
-				}
-				
-				for (ncol = 0; ncol < ncols; ncol++)
-				{
-					int srctype;
-					
-					#ifdef DEBUG
-						char *col_name;
-					#endif
-					
-					DBINT srclen;
-					BYTE* src;
-					
-					#ifdef DEBUG
-						col_name = dbcolname(festate->dbproc, ncol + 1);
-					
-					
-						ereport(NOTICE,
-							(errmsg("Fetching column %i (%s)", ncol, col_name)
-							));
-					#endif
-					
-					srctype = dbcoltype(festate->dbproc, ncol + 1);
-					
-					#ifdef DEBUG
-						ereport(NOTICE,
-							(errmsg("Type is %i", srctype)
-							));
-					#endif
+		if ((ch = strstr(version, " - ")) != NULL)
+			dialect->major_version = atoi(ch + 3);
+	}
+	
+	else if (strstr(version, "Adaptive Server") || strstr(version, "Sybase"))
+	{
+		dialect->product = TDS_PRODUCT_SYBASE;
+		
+		if ((ch = strchr(version, '/')) != NULL)
+			dialect->major_version = atoi(ch + 1);
+	}
+}
+
+/* get the number of rows returned by a query */
+
+static int tdsGetRowCount(TdsFdwOptionSet* option_set, LOGINREC *login, DBPROCESS *dbproc)
+{
+	int rows_report = 0;
+	int rows_increment = 0;
+	RETCODE erc;
+	int ret_code;
+	
+	#ifdef DEBUG
+		ereport(NOTICE,
+			(errmsg("----> starting tdsGetRowCount")
+			));
+	#endif		
+	
+	#ifdef DEBUG
+		ereport(NOTICE,
+			(errmsg("Setting database command to %s", option_set->query)
+			));
+	#endif
+	
+	if ((erc = dbcmd(dbproc, option_set->query)) == FAIL)
+	{
+		ereport(ERROR,
+			(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
+				errmsg("Failed to set current query to %s", option_set->query)
+			));		
+
+		goto cleanup;
+	}
+	
+	#ifdef DEBUG
+		ereport(NOTICE,
+			(errmsg("Executing the query")
+			));
+	#endif
+	
+	if ((erc = dbsqlexec(dbproc)) == FAIL)
+	{
+		ereport(ERROR,
+			(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
+				errmsg("Failed to execute query %s", option_set->query)
+			));	
+
+		goto cleanup;
+	}
+
+	#ifdef DEBUG
+		ereport(NOTICE,
+			(errmsg("Query executed correctly")
+			));
+		ereport(NOTICE,
+			(errmsg("Getting results")
+			));				
+	#endif
+
+	erc = dbresults(dbproc);
+	
+	if (erc == FAIL)
+	{
+		ereport(ERROR,
+			(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
+				errmsg("Failed to get results from query %s", option_set->query)
+			));
 			
-					srclen = dbdatlen(festate->dbproc, ncol + 1);
-					
-					#ifdef DEBUG
-						ereport(NOTICE,
-							(errmsg("Data length is %i", srclen)
-							));
-					#endif					
+		goto cleanup;
+	}
+	
+	else if (erc == NO_MORE_RESULTS)
+	{
+		#ifdef DEBUG
+			ereport(NOTICE,
+				(errmsg("There appears to be no results from query %s", option_set->query)
+				));
+		#endif
+		
+		goto cleanup;
+	}
+	
+	else if (erc == SUCCEED)
+	{
+		#ifdef DEBUG
+			ereport(NOTICE,
+				(errmsg("Successfully got results")
+				));
+		#endif
+		
+		if ((ret_code = dbnextrow(dbproc)) != NO_MORE_ROWS)
+		{
+			switch (ret_code)
+			{
+				case REG_ROW:
+					rows_increment++;
+					break;
 					
-					src = dbdata(festate->dbproc, ncol + 1);
+				case BUF_FULL:
+					ereport(ERROR,
+						(errcode(ERRCODE_FDW_OUT_OF_MEMORY),
+							errmsg("Buffer filled up while getting plan for query")
+						));					
 
-					if (srclen == 0)
-					{
-						#ifdef DEBUG
-							ereport(NOTICE,
-								(errmsg("Column value is NULL")
-								));
-						#endif	
-						
-						values[ncol] = NULL;
-					}					
-					
-					else if (src == NULL)
-					{
-						#ifdef DEBUG
-							ereport(NOTICE,
-								(errmsg("Column value pointer is NULL, but probably shouldn't be")
-								));
-						#endif	
-						
-						values[ncol] = NULL;
-					}
-					
-					else
-					{
-						values[ncol] = tdsConvertToCString(festate->dbproc, srctype, src, srclen);
-					}
-				}
-				
-				#ifdef DEBUG
-					ereport(NOTICE,
-						(errmsg("Printing all %i values", ncols)
-						));
-								
-					for (ncol = 0; ncol < ncols; ncol++)
-					{
-						if (values[ncol] != NULL)
-						{
-							ereport(NOTICE,
-								(errmsg("values[%i]: %s", ncol, values[ncol])
-								));
-						}
+					goto cleanup;
 						
-						else
-						{
-							ereport(NOTICE,
-								(errmsg("values[%i]: NULL", ncol)
-								));
-						}
-					}
-				#endif
-				
-				tuple = BuildTupleFromCStrings(TupleDescGetAttInMetadata(node->ss.ss_currentRelation->rd_att), values);
-				ExecStoreTuple(tuple, slot, InvalidBuffer, false);
-				break;
+				case FAIL:
+					ereport(ERROR,
+						(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
+							errmsg("Failed to get row while getting plan for query")
+						));				
+
+					goto cleanup;
 				
-			case BUF_FULL:
-				ereport(ERROR,
-					(errcode(ERRCODE_FDW_OUT_OF_MEMORY),
-					errmsg("Buffer filled up during query")
-					));
-				break;
-					
-			case FAIL:
-				ereport(ERROR,
-					(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
-					errmsg("Failed to get row during query")
-					));
+				default:
+					ereport(ERROR,
+						(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
+							errmsg("Failed to get plan for query. Unknown return code.")
+						));					
+
+					goto cleanup;
+			}
+		}
+		
+		rows_report = DBCOUNT(dbproc);
+		
+		#ifdef DEBUG
+			ereport(NOTICE,
+				(errmsg("We counted %i rows, and dbcount says %i rows", rows_increment, rows_report)
+				));
+		#endif		
+	}
+	
+	else
+	{
+		ereport(ERROR,
+			(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
+				errmsg("Unknown return code getting results from query %s", option_set->query)
+			));		
+	}
+	
+cleanup:	
+	#ifdef DEBUG
+		ereport(NOTICE,
+			(errmsg("----> finishing tdsGetRowCount")
+			));
+	#endif		
+	
+	return rows_report;
+}
+
+/* get the startup cost for the query */
+
+static int tdsGetStartupCost(TdsFdwOptionSet* option_set)
+{
+	int startup_cost;
+	
+	#ifdef DEBUG
+		ereport(NOTICE,
+			(errmsg("----> starting tdsGetStartupCost")
+			));
+	#endif	
+	
+	if (strcmp(option_set->servername, "127.0.0.1") == 0 || strcmp(option_set->servername, "localhost") == 0)
+		startup_cost = 0;
+	else
+		startup_cost = 25;
+		
+	#ifdef DEBUG
+		ereport(NOTICE,
+			(errmsg("----> finishing tdsGetStartupCost")
+			));
+	#endif		
+		
+	return startup_cost;
+}
+
+/* the size of the array that a value needs when dbconvert() makes it a C string */
+
+static int tdsGetConvertedLength(int srctype, DBINT srclen)
+{
+	switch(srctype)
+	{
+		case SYBCHAR:
+		case SYBVARCHAR:
+		case SYBTEXT:
+			return srclen + 1;
+		case SYBBINARY:
+		case SYBVARBINARY:
+		case SYBIMAGE:
+			return srclen * 2 + 1; /* as hex digits */
+		default:
+			return CONVERTED_VALUE_LENGTH;
+	}
+}
+
+static char* tdsConvertToCString(DBPROCESS* dbproc, int srctype, const BYTE* src, DBINT srclen)
+{
+	char* dest = NULL;
+	int real_destlen = tdsGetConvertedLength(srctype, srclen); /* the size of the array */
+	DBINT destlen = -1; /* the size to pass to dbconvert (-1 means to null terminate it) */
+	int desttype = SYBCHAR;
+	int ret_value;
+	
+	#ifdef DEBUG
+		ereport(NOTICE,
+			(errmsg("Source type is %i. Destination type is %i", srctype, desttype)
+			));
+		ereport(NOTICE,
+			(errmsg("Source length is %i. Destination length is %i. Real destination length is %i", srclen, destlen, real_destlen)
+			));
+	#endif	
+	
+	if (dbwillconvert(srctype, desttype) != FALSE)
+	{
+		if ((dest = palloc(real_destlen * sizeof(char))) == NULL)
+		{
+			ereport(ERROR,
+				(errcode(ERRCODE_FDW_OUT_OF_MEMORY),
+				errmsg("Failed to allocate memory for column value")
+				));
+		}
+		
+		ret_value = dbconvert(dbproc, srctype, src, srclen, desttype, (BYTE *) dest, destlen);
+		
+		if (ret_value == FAIL)
+		{
+			#ifdef DEBUG
+				ereport(NOTICE,
+					(errmsg("Failed to convert column")
+					));
+			#endif	
+		}
+		
+		else if (ret_value == -1)
+		{
+			#ifdef DEBUG
+				ereport(NOTICE,
+					(errmsg("Failed to convert column. Could have been a NULL pointer or bad data type.")
+					));
+			#endif	
+		}
+	}
+	
+	else
+	{
+		#ifdef DEBUG
+			ereport(NOTICE,
+				(errmsg("Column cannot be converted to this type.")
+				));
+		#endif
+	}
+	
+	return dest;
+	
+}
+
+/*
+ * Look up the columns of the result once, after dbresults(), and choose how each
+ * one is decoded. The result columns are matched to the local columns by name,
+ * so that a table on the foreign server can have its columns in another order,
+ * or more of them. If some local column can't be found that way, e.g. because a
+ * query has unnamed columns, they are matched by position.
+ */
+
+static void tdsGetColumns(ForeignScanState *node)
+{
+	TdsFdwExecutionState *festate = (TdsFdwExecutionState *) node->fdw_state;
+	TupleDesc tupdesc = RelationGetDescr(node->ss.ss_currentRelation);
+	bool *matched;
+	bool by_name = true;
+	int row_size = tupdesc->natts * (sizeof(Datum) + sizeof(bool)) + 1;
+	int ncol;
+	int i;
+	
+	#ifdef DEBUG
+		ereport(NOTICE,
+			(errmsg("----> starting tdsGetColumns")
+			));
+	#endif
+	
+	festate->ncols = dbnumcols(festate->dbproc);
+	
+	if ((festate->columns = palloc0((festate->ncols + 1) * sizeof(COL))) == NULL)
+	{
+		ereport(ERROR,
+			(errcode(ERRCODE_FDW_OUT_OF_MEMORY),
+				errmsg("Failed to allocate memory for column array")
+			));
+	}
+	
+	matched = palloc0((tupdesc->natts + 1) * sizeof(bool));
+	
+	for (ncol = 0; ncol < festate->ncols; ncol++)
+	{
+		COL *column = &festate->columns[ncol];
+		
+		column->name = dbcolname(festate->dbproc, ncol + 1);
+		column->type = dbcoltype(festate->dbproc, ncol + 1);
+		column->size = dbcollen(festate->dbproc, ncol + 1);
+		
+		#ifdef DEBUG
+			ereport(NOTICE,
+				(errmsg("Column %i is %s, with type %i and size %i", ncol, column->name, column->type, column->size)
+				));
+		#endif
+		
+		for (i = 0; i < tupdesc->natts && column->name; i++)
+		{
+			if (festate->attnames[i] && !matched[i] && pg_strcasecmp(column->name, festate->attnames[i]) == 0)
+			{
+				column->attnum = i + 1;
+				matched[i] = true;
+				break;
+			}
+		}
+	}
+	
+	for (i = 0; i < festate->nattnums; i++)
+	{
+		if (festate->attnames[festate->attnums[i] - 1] && !matched[festate->attnums[i] - 1])
+			by_name = false;
+	}
+	
+	for (ncol = 0; ncol < festate->ncols; ncol++)
+	{
+		COL *column = &festate->columns[ncol];
+		
+		/* any extra columns in the result are ignored */
+		if (!by_name)
+			column->attnum = (ncol < festate->nattnums) ? festate->attnums[ncol] : 0;
+		
+		if (column->attnum == 0)
+			continue;
+		
+		column->typid = tupdesc->attrs[column->attnum - 1]->atttypid;
+		column->decoder = tdsGetColumnDecoder(festate, column);
+		
+		/* the buffer for converting values is sized for the column, unless it can be very long */
+		if (column->decoder == tdsDecodeConverted)
+		{
+			int length = tdsGetConvertedLength(column->type, column->size);
+			
+			if (length > 0 && length <= MAX_COLUMN_BUFFER_SIZE)
+			{
+				column->buffer = MemoryContextAlloc(festate->scan_cxt, length);
+				column->buffer_size = length;
+			}
+		}
+	}
+	
+	pfree(matched);
+	
+	/* as many rows are fetched at a time as fit in the memory for a batch */
+	for (ncol = 0; ncol < festate->ncols; ncol++)
+	{
+		COL *column = &festate->columns[ncol];
+		
+		if (column->attnum != 0)
+			row_size += (column->size > 0 && column->size < BATCH_VALUE_SIZE) ? column->size : BATCH_VALUE_SIZE;
+	}
+	
+	festate->batch_rows = Max(1, Min(festate->fetch_size, BATCH_MEMORY_SIZE / row_size));
+	festate->batch_values = palloc(festate->batch_rows * tupdesc->natts * sizeof(Datum));
+	festate->batch_nulls = palloc(festate->batch_rows * tupdesc->natts * sizeof(bool));
+	
+	#ifdef DEBUG
+		ereport(NOTICE,
+			(errmsg("Columns are matched by %s", by_name ? "name" : "position")
+			));
+		ereport(NOTICE,
+			(errmsg("Fetching %i rows at a time", festate->batch_rows)
+			));
+		ereport(NOTICE,
+			(errmsg("----> finishing tdsGetColumns")
+			));
+	#endif
+}
+
+/*
+ * choose the function that decodes the values of a column. Fixed-width numbers
+ * are read straight into the local type when it can hold every value, and the
+ * rest go through text and the input function of the local type.
+ */
+
+static TdsFdwColumnDecoder tdsGetColumnDecoder(TdsFdwExecutionState *festate, COL *column)
+{
+	if (festate->compressed && festate->compressed[column->attnum - 1])
+		return tdsDecodeCompressed;
+	
+	switch (column->type)
+	{
+		case SYBCHAR:
+		case SYBVARCHAR:
+		case SYBTEXT:
+			/* varchar(n) and char(n) need the input function to check or pad the length */
+			if (column->typid == TEXTOID ||
+				(column->typid == VARCHAROID && festate->attinmeta->atttypmods[column->attnum - 1] < 0))
+				return tdsDecodeText;
+			break;
+			
+		case SYBBINARY:
+		case SYBVARBINARY:
+		case SYBIMAGE:
+			if (column->typid == BYTEAOID)
+				return tdsDecodeBinary;
+			break;
+			
+		case SYBINT1:
+			if (column->typid == INT2OID || column->typid == INT4OID || column->typid == INT8OID)
+				return tdsDecodeTinyInt;
+			break;
+			
+		case SYBINT2:
+			if (column->typid == INT2OID || column->typid == INT4OID || column->typid == INT8OID)
+				return tdsDecodeSmallInt;
+			break;
+			
+		case SYBINT4:
+			if (column->typid == INT4OID || column->typid == INT8OID)
+				return tdsDecodeInt;
+			break;
+			
+		case SYBINT8:
+			if (column->typid == INT8OID)
+				return tdsDecodeBigInt;
+			break;
+			
+		/* float8 reads real as text, so that 0.1 stays 0.1 instead of being widened in binary */
+		case SYBREAL:
+			if (column->typid == FLOAT4OID)
+				return tdsDecodeReal;
+			break;
+			
+		case SYBFLT8:
+			if (column->typid == FLOAT8OID)
+				return tdsDecodeFloat;
+			break;
+			
+		case SYBBIT:
+			if (column->typid == BOOLOID)
+				return tdsDecodeBit;
+			break;
+			
+		case SYBUNIQUE:
+			if (column->typid == UUIDOID)
+				return tdsDecodeUniqueIdentifier;
+			break;
+			
+		case SYBNUMERIC:
+		case SYBDECIMAL:
+			if (column->typid == NUMERICOID)
+				return tdsDecodeNumeric;
+			break;
+			
+		case SYBMONEY:
+			if (column->typid == NUMERICOID)
+				return tdsDecodeMoney;
+			break;
+			
+		case SYBMONEY4:
+			if (column->typid == NUMERICOID)
+				return tdsDecodeSmallMoney;
+			break;
+			
+		case SYBDATETIME:
+			if (column->typid == TIMESTAMPOID || column->typid == TIMESTAMPTZOID ||
+				column->typid == DATEOID || column->typid == TIMEOID)
+				return tdsDecodeDateTime;
+			break;
+			
+		case SYBDATETIME4:
+			if (column->typid == TIMESTAMPOID || column->typid == TIMESTAMPTZOID ||
+				column->typid == DATEOID || column->typid == TIMEOID)
+				return tdsDecodeSmallDateTime;
+			break;
+			
+		case SYBMSDATE:
+			if (column->typid == TIMESTAMPOID || column->typid == TIMESTAMPTZOID || column->typid == DATEOID)
+				return tdsDecodeDateTimeAll;
+			break;
+			
+		case SYBMSTIME:
+			if (column->typid == TIMEOID)
+				return tdsDecodeDateTimeAll;
+			break;
+			
+		case SYBMSDATETIME2:
+		case SYBMSDATETIMEOFFSET:
+			if (column->typid == TIMESTAMPOID || column->typid == TIMESTAMPTZOID ||
+				column->typid == DATEOID || column->typid == TIMEOID)
+				return tdsDecodeDateTimeAll;
+			break;
+	}
+	
+	if (dbwillconvert(column->type, SYBCHAR) == FALSE)
+	{
+		ereport(WARNING,
+			(errcode(ERRCODE_FDW_INVALID_DATA_TYPE),
+				errmsg("Column %s has type %i, which cannot be converted, so its values are NULL",
+					column->name ? column->name : "", column->type)
+			));
+		
+		return tdsDecodeNull;
+	}
+	
+	return tdsDecodeConverted;
+}
+
+/* get the local value from its text, with the input function of the local column */
+
+static Datum tdsInputValue(TdsFdwExecutionState *festate, COL *column, char *str, bool *isnull)
+{
+	AttInMetadata *attinmeta = festate->attinmeta;
+	int att = column->attnum - 1;
+	
+	if (str == NULL)
+	{
+		*isnull = true;
+		return (Datum) 0;
+	}
+	
+	return InputFunctionCall(&attinmeta->attinfuncs[att], str, attinmeta->attioparams[att], attinmeta->atttypmods[att]);
+}
+
+/* convert a value to text with DB-Library, in the buffer of the column */
+
+static Datum tdsDecodeConverted(TdsFdwExecutionState *festate, COL *column, BYTE *src, DBINT srclen, bool *isnull)
+{
+	int length = tdsGetConvertedLength(column->type, srclen);
+	
+	/* the buffer lasts for the scan, and only grows for longer values */
+	if (length > column->buffer_size)
+	{
+		if (column->buffer)
+			pfree(column->buffer);
+		
+		column->buffer = MemoryContextAlloc(festate->scan_cxt, length);
+		column->buffer_size = length;
+	}
+	
+	if (dbconvert(festate->dbproc, column->type, src, srclen, SYBCHAR, (BYTE *) column->buffer, -1) < 0)
+	{
+		#ifdef DEBUG
+			ereport(NOTICE,
+				(errmsg("Failed to convert column %s", column->name ? column->name : "")
+				));
+		#endif
+		
+		*isnull = true;
+		return (Datum) 0;
+	}
+	
+	return tdsInputValue(festate, column, column->buffer, isnull);
+}
+
+/* decompress a value of a column that was compressed by COMPRESS() */
+
+static Datum tdsDecodeCompressed(TdsFdwExecutionState *festate, COL *column, BYTE *src, DBINT srclen, bool *isnull)
+{
+	return tdsInputValue(festate, column, tdsDecompressToCString(src, srclen, column->typid == BYTEAOID), isnull);
+}
+
+/* a value of a type that can't be converted */
+
+static Datum tdsDecodeNull(TdsFdwExecutionState *festate, COL *column, BYTE *src, DBINT srclen, bool *isnull)
+{
+	*isnull = true;
+	return (Datum) 0;
+}
+
+/*
+ * the number of bytes at the start of a string that are ASCII other than NUL.
+ * Most text is ASCII, so this looks at 16 bytes at a time with SSE2 where the
+ * compiler has it (as on every x86-64), or otherwise at 8 bytes at a time.
+ */
+
+static size_t tdsAsciiLength(const unsigned char *src, size_t len)
+{
+	size_t i = 0;
+	
+	#ifdef __SSE2__
+		const __m128i zero = _mm_setzero_si128();
+		
+		for (; i + 16 <= len; i += 16)
+		{
+			__m128i chunk = _mm_loadu_si128((const __m128i *) (src + i));
+			
+			if (_mm_movemask_epi8(_mm_or_si128(chunk, _mm_cmpeq_epi8(chunk, zero))) != 0)
+				break;
+		}
+	#else
+		for (; i + 8 <= len; i += 8)
+		{
+			uint64 chunk;
+			
+			memcpy(&chunk, src + i, sizeof(chunk));
+			
+			/* a byte with its high bit set, or a zero byte */
+			if (((chunk | (chunk - UINT64CONST(0x0101010101010101))) & UINT64CONST(0x8080808080808080)) != 0)
+				break;
+		}
+	#endif
+	
+	for (; i < len; i++)
+	{
+		if (src[i] == 0 || src[i] >= 0x80)
+			break;
+	}
+	
+	return i;
+}
+
+/*
+ * text is copied once, from the row buffer of DB-Library into the value. It is
+ * checked unless FreeTDS was asked for the encoding of the database.
+ */
+
+static Datum tdsDecodeText(TdsFdwExecutionState *festate, COL *column, BYTE *src, DBINT srclen, bool *isnull)
+{
+	if (festate->verify_encoding)
+	{
+		/* ASCII is valid in every server encoding, so only what follows it is checked */
+		size_t ascii = tdsAsciiLength(src, srclen);
+		
+		if (ascii < (size_t) srclen)
+			pg_verify_mbstr(GetDatabaseEncoding(), (const char *) src + ascii, srclen - ascii, false);
+	}
+	
+	return PointerGetDatum(cstring_to_text_with_len((const char *) src, srclen));
+}
+
+static Datum tdsDecodeBinary(TdsFdwExecutionState *festate, COL *column, BYTE *src, DBINT srclen, bool *isnull)
+{
+	bytea *result = (bytea *) palloc(srclen + VARHDRSZ);
+	
+	SET_VARSIZE(result, srclen + VARHDRSZ);
+	memcpy(VARDATA(result), src, srclen);
+	
+	return PointerGetDatum(result);
+}
+
+/*
+ * The fixed-width types are read from the row buffer of DB-Library, which has
+ * them in the byte order of the client. The buffer may not be aligned for them.
+ */
+
+/* return an integer as the local integer type of the column, which is at least as wide */
+
+#define TDS_INTEGER_DATUM(column, value) \
+	((column)->typid == INT2OID ? Int16GetDatum((int16) (value)) : \
+	 (column)->typid == INT4OID ? Int32GetDatum((int32) (value)) : \
+	 Int64GetDatum((int64) (value)))
+
+/* tinyint, which is unsigned */
+
+static Datum tdsDecodeTinyInt(TdsFdwExecutionState *festate, COL *column, BYTE *src, DBINT srclen, bool *isnull)
+{
+	DBTINYINT value;
+	
+	memcpy(&value, src, sizeof(value));
+	
+	return TDS_INTEGER_DATUM(column, value);
+}
+
+static Datum tdsDecodeSmallInt(TdsFdwExecutionState *festate, COL *column, BYTE *src, DBINT srclen, bool *isnull)
+{
+	DBSMALLINT value;
+	
+	memcpy(&value, src, sizeof(value));
+	
+	return TDS_INTEGER_DATUM(column, value);
+}
+
+static Datum tdsDecodeInt(TdsFdwExecutionState *festate, COL *column, BYTE *src, DBINT srclen, bool *isnull)
+{
+	DBINT value;
+	
+	memcpy(&value, src, sizeof(value));
+	
+	return TDS_INTEGER_DATUM(column, value);
+}
+
+static Datum tdsDecodeBigInt(TdsFdwExecutionState *festate, COL *column, BYTE *src, DBINT srclen, bool *isnull)
+{
+	DBBIGINT value;
+	
+	memcpy(&value, src, sizeof(value));
+	
+	return Int64GetDatum((int64) value);
+}
+
+static Datum tdsDecodeReal(TdsFdwExecutionState *festate, COL *column, BYTE *src, DBINT srclen, bool *isnull)
+{
+	DBREAL value;
+	
+	memcpy(&value, src, sizeof(value));
+	
+	return Float4GetDatum((float4) value);
+}
+
+static Datum tdsDecodeFloat(TdsFdwExecutionState *festate, COL *column, BYTE *src, DBINT srclen, bool *isnull)
+{
+	DBFLT8 value;
+	
+	memcpy(&value, src, sizeof(value));
+	
+	return Float8GetDatum((float8) value);
+}
+
+static Datum tdsDecodeBit(TdsFdwExecutionState *festate, COL *column, BYTE *src, DBINT srclen, bool *isnull)
+{
+	return BoolGetDatum(*src != 0);
+}
+
+/*
+ * DB-Library has a uniqueidentifier as a 32-bit and two 16-bit integers in the
+ * byte order of the client, followed by 8 bytes. A uuid has all of them in the
+ * order in which they are written.
+ */
+
+static Datum tdsDecodeUniqueIdentifier(TdsFdwExecutionState *festate, COL *column, BYTE *src, DBINT srclen, bool *isnull)
+{
+	pg_uuid_t *uuid = (pg_uuid_t *) palloc(sizeof(pg_uuid_t));
+	uint32 data1;
+	uint16 data2;
+	uint16 data3;
+	
+	memcpy(&data1, src, sizeof(data1));
+	memcpy(&data2, src + 4, sizeof(data2));
+	memcpy(&data3, src + 6, sizeof(data3));
+	
+	uuid->data[0] = (data1 >> 24) & 0xFF;
+	uuid->data[1] = (data1 >> 16) & 0xFF;
+	uuid->data[2] = (data1 >> 8) & 0xFF;
+	uuid->data[3] = data1 & 0xFF;
+	uuid->data[4] = (data2 >> 8) & 0xFF;
+	uuid->data[5] = data2 & 0xFF;
+	uuid->data[6] = (data3 >> 8) & 0xFF;
+	uuid->data[7] = data3 & 0xFF;
+	memcpy(&uuid->data[8], src + 8, 8);
+	
+	return UUIDPGetDatum(uuid);
+}
+
+/*
+ * A DBNUMERIC has a sign byte, which is 1 for negative numbers, followed by the
+ * magnitude in big-endian order. The digits are worked out exactly, and numeric
+ * applies the typmod of the column to them.
+ */
+
+static Datum tdsDecodeNumeric(TdsFdwExecutionState *festate, COL *column, BYTE *src, DBINT srclen, bool *isnull)
+{
+	const DBNUMERIC *numeric = (const DBNUMERIC *) src;
+	uint32 limbs[TDS_NUMERIC_MAX_PRECISION / 9 + 2];
+	int nlimbs = 0;
+	char digits[TDS_NUMERIC_MAX_PRECISION + 2];
+	char str[TDS_NUMERIC_MAX_PRECISION + 4];
+	int ndigits = 0;
+	int scale = numeric->scale;
+	int i, j;
+	char *dest = str;
+	
+	if (numeric->precision < 1 || numeric->precision > TDS_NUMERIC_MAX_PRECISION ||
+		scale > numeric->precision)
+		return tdsDecodeConverted(festate, column, src, srclen, isnull);
+	
+	/* the magnitude, in base 10^9 */
+	for (i = 1; i < TDS_NUMERIC_BYTES[numeric->precision]; i++)
+	{
+		uint64 carry = numeric->array[i];
+		
+		for (j = 0; j < nlimbs; j++)
+		{
+			uint64 value = (uint64) limbs[j] * 256 + carry;
+			
+			limbs[j] = (uint32) (value % 1000000000);
+			carry = value / 1000000000;
+		}
+		
+		if (carry)
+			limbs[nlimbs++] = (uint32) carry;
+	}
+	
+	/* its decimal digits, least significant first */
+	for (j = 0; j < nlimbs; j++)
+	{
+		uint32 value = limbs[j];
+		
+		for (i = 0; i < 9 && (value || j < nlimbs - 1); i++)
+		{
+			digits[ndigits++] = '0' + value % 10;
+			value /= 10;
+		}
+	}
+	
+	while (ndigits <= scale)
+		digits[ndigits++] = '0';
+	
+	if (numeric->array[0] == 1)
+		*dest++ = '-';
+	
+	for (i = ndigits - 1; i >= 0; i--)
+	{
+		*dest++ = digits[i];
+		
+		if (i == scale && i > 0)
+			*dest++ = '.';
+	}
+	
+	*dest = '\0';
+	
+	return tdsInputValue(festate, column, str, isnull);
+}
+
+/* money is a count of ten-thousandths */
+
+static Datum tdsMoneyToNumeric(TdsFdwExecutionState *festate, COL *column, int64 value, bool *isnull)
+{
+	char str[32];
+	uint64 magnitude = (value < 0) ? -((uint64) value) : (uint64) value;
+	
+	snprintf(str, sizeof(str), "%s" UINT64_FORMAT ".%04u", (value < 0) ? "-" : "",
+		magnitude / 10000, (unsigned int) (magnitude % 10000));
+	
+	return tdsInputValue(festate, column, str, isnull);
+}
+
+static Datum tdsDecodeMoney(TdsFdwExecutionState *festate, COL *column, BYTE *src, DBINT srclen, bool *isnull)
+{
+	DBMONEY money;
+	
+	memcpy(&money, src, sizeof(money));
+	
+	return tdsMoneyToNumeric(festate, column, (int64) (((uint64) (uint32) money.mnyhigh << 32) | (uint32) money.mnylow), isnull);
+}
+
+static Datum tdsDecodeSmallMoney(TdsFdwExecutionState *festate, COL *column, BYTE *src, DBINT srclen, bool *isnull)
+{
+	DBMONEY4 money;
+	
+	memcpy(&money, src, sizeof(money));
+	
+	return tdsMoneyToNumeric(festate, column, (int64) money.mny4, isnull);
+}
+
+/*
+ * make a local date or time value from the days since 2000-01-01 and the
+ * microseconds since midnight. offset is the minutes that the value is ahead
+ * of UTC, and it is only given by datetimeoffset, which is in UTC. The other
+ * types have no time zone, so they are taken to be in the local one. typmod
+ * is the precision of the local column, or -1 if it has none.
+ */
+
+static Datum tdsDateTimeToDatum(COL *column, int64 days, int64 usecs, int offset, int32 typmod)
+{
+	Timestamp timestamp;
+	
+	switch (column->typid)
+	{
+		case DATEOID:
+			if (offset)
+			{
+				usecs += (int64) offset * 60 * 1000000;
+				days += (usecs >= 0) ? usecs / ((int64) 86400 * 1000000) : -1 - (-usecs - 1) / ((int64) 86400 * 1000000);
+			}
+			
+			return DateADTGetDatum((DateADT) days);
+			
+		case TIMEOID:
+			if (offset)
+			{
+				usecs = (usecs + (int64) offset * 60 * 1000000) % ((int64) 86400 * 1000000);
+				
+				if (usecs < 0)
+					usecs += (int64) 86400 * 1000000;
+			}
+			
+			/* round to the precision of the local column like the input function does */
+			#ifdef HAVE_INT64_TIMESTAMP
+				if (typmod >= 0)
+					return DirectFunctionCall2(time_scale, TimeADTGetDatum((TimeADT) usecs), Int32GetDatum(typmod));
+				
+				return TimeADTGetDatum((TimeADT) usecs);
+			#else
+				if (typmod >= 0)
+					return DirectFunctionCall2(time_scale, TimeADTGetDatum((TimeADT) usecs / 1000000.0), Int32GetDatum(typmod));
+				
+				return TimeADTGetDatum((TimeADT) usecs / 1000000.0);
+			#endif
+	}
+	
+	#ifdef HAVE_INT64_TIMESTAMP
+		timestamp = days * USECS_PER_DAY + usecs;
+	#else
+		timestamp = days * (double) SECS_PER_DAY + usecs / 1000000.0;
+	#endif
+	
+	if (column->type == SYBMSDATETIMEOFFSET && column->typid != TIMESTAMPTZOID)
+	{
+		#ifdef HAVE_INT64_TIMESTAMP
+			timestamp += (int64) offset * 60 * 1000000;
+		#else
+			timestamp += offset * 60.0;
+		#endif
+	}
+	
+	if (column->typid == TIMESTAMPTZOID)
+	{
+		TimestampTz timestamptz;
+		
+		if (column->type == SYBMSDATETIMEOFFSET)
+			timestamptz = (TimestampTz) timestamp;
+		else
+			timestamptz = DatumGetTimestampTz(DirectFunctionCall1(timestamp_timestamptz, TimestampGetDatum(timestamp)));
+		
+		if (typmod >= 0)
+			return DirectFunctionCall2(timestamptz_scale, TimestampTzGetDatum(timestamptz), Int32GetDatum(typmod));
+		
+		return TimestampTzGetDatum(timestamptz);
+	}
+	
+	if (typmod >= 0)
+		return DirectFunctionCall2(timestamp_scale, TimestampGetDatum(timestamp), Int32GetDatum(typmod));
+	
+	return TimestampGetDatum(timestamp);
+}
+
+/* datetime has the days since 1900-01-01 and the 300ths of a second since midnight */
+
+static Datum tdsDecodeDateTime(TdsFdwExecutionState *festate, COL *column, BYTE *src, DBINT srclen, bool *isnull)
+{
+	DBDATETIME datetime;
+	
+	memcpy(&datetime, src, sizeof(datetime));
+	
+	return tdsDateTimeToDatum(column, (int64) datetime.dtdays - TDS_EPOCH_DAYS,
+		((int64) datetime.dttime * 10000 + 1) / 3, 0, festate->attinmeta->atttypmods[column->attnum - 1]);
+}
+
+/* smalldatetime has the days since 1900-01-01 and the minutes since midnight */
+
+static Datum tdsDecodeSmallDateTime(TdsFdwExecutionState *festate, COL *column, BYTE *src, DBINT srclen, bool *isnull)
+{
+	DBDATETIME4 datetime;
+	
+	memcpy(&datetime, src, sizeof(datetime));
+	
+	return tdsDateTimeToDatum(column, (int64) datetime.days - TDS_EPOCH_DAYS,
+		(int64) datetime.minutes * 60 * 1000000, 0, festate->attinmeta->atttypmods[column->attnum - 1]);
+}
+
+/*
+ * date, time, datetime2 and datetimeoffset have the days since 1900-01-01 and
+ * the 100ns units since midnight, which are rounded to microseconds.
+ */
+
+static Datum tdsDecodeDateTimeAll(TdsFdwExecutionState *festate, COL *column, BYTE *src, DBINT srclen, bool *isnull)
+{
+	DBDATETIMEALL datetime;
+	
+	memcpy(&datetime, src, sizeof(datetime));
+	
+	return tdsDateTimeToDatum(column, datetime.has_date ? (int64) datetime.date - TDS_EPOCH_DAYS : 0,
+		datetime.has_time ? (int64) (datetime.time + 5) / 10 : 0,
+		datetime.has_offset ? datetime.offset : 0, festate->attinmeta->atttypmods[column->attnum - 1]);
+}
+
+/* inflate a value compressed by COMPRESS() on the remote server */
+
+static char* tdsDecompressToCString(const BYTE* src, DBINT srclen, bool is_bytea)
+{
+	z_stream stream;
+	unsigned char *buffer;
+	size_t buffer_len;
+	char *dest;
+	int ret_value;
+	
+	#ifdef DEBUG
+		ereport(NOTICE,
+			(errmsg("Decompressing column value of length %i", srclen)
+			));
+	#endif
+	
+	memset(&stream, 0, sizeof(stream));
+	
+	/* COMPRESS() produces the gzip format, so add 16 to the window size */
+	if (inflateInit2(&stream, 16 + MAX_WBITS) != Z_OK)
+	{
+		ereport(ERROR,
+			(errcode(ERRCODE_FDW_OUT_OF_MEMORY),
+				errmsg("Failed to initialize zlib: %s", stream.msg ? stream.msg : "unknown error")
+			));
+	}
+	
+	buffer_len = (size_t) srclen * 4 + 64;
+	
+	if ((buffer = palloc(buffer_len)) == NULL)
+	{
+		inflateEnd(&stream);
+		
+		ereport(ERROR,
+			(errcode(ERRCODE_FDW_OUT_OF_MEMORY),
+				errmsg("Failed to allocate memory for column value")
+			));
+	}
+	
+	stream.next_in = (Bytef *) src;
+	stream.avail_in = srclen;
+	
+	for (;;)
+	{
+		stream.next_out = buffer + stream.total_out;
+		stream.avail_out = buffer_len - stream.total_out;
+		
+		ret_value = inflate(&stream, Z_NO_FLUSH);
+		
+		if (ret_value == Z_STREAM_END)
+			break;
+		
+		if ((ret_value != Z_OK && ret_value != Z_BUF_ERROR) ||
+			(ret_value == Z_BUF_ERROR && stream.avail_out != 0))
+		{
+			inflateEnd(&stream);
+			
+			ereport(ERROR,
+				(errcode(ERRCODE_FDW_INVALID_STRING_FORMAT),
+					errmsg("Failed to decompress column value: %s", stream.msg ? stream.msg : "truncated data")
+				));
+		}
+		
+		if (stream.avail_out == 0)
+		{
+			if (buffer_len * 2 > MaxAllocSize)
+			{
+				inflateEnd(&stream);
+				
+				ereport(ERROR,
+					(errcode(ERRCODE_FDW_OUT_OF_MEMORY),
+						errmsg("Decompressed column value is too large")
+					));
+			}
+			
+			buffer_len *= 2;
+			buffer = repalloc(buffer, buffer_len);
+		}
+	}
+	
+	inflateEnd(&stream);
+	
+	if (is_bytea)
+	{
+		static const char hex_digits[] = "0123456789abcdef";
+		size_t i;
+		char *ptr;
+		
+		/* use the hex format understood by byteain */
+		if ((dest = palloc(stream.total_out * 2 + 3)) == NULL)
+		{
+			ereport(ERROR,
+				(errcode(ERRCODE_FDW_OUT_OF_MEMORY),
+					errmsg("Failed to allocate memory for column value")
+				));
+		}
+		
+		ptr = dest;
+		*ptr++ = '\\';
+		*ptr++ = 'x';
+		
+		for (i = 0; i < stream.total_out; i++)
+		{
+			*ptr++ = hex_digits[buffer[i] >> 4];
+			*ptr++ = hex_digits[buffer[i] & 0x0F];
+		}
+		
+		*ptr = '\0';
+	}
+	
+	else
+	{
+		/* text was compressed as nvarchar */
+		dest = tdsUtf16ToServerEncoding(buffer, stream.total_out);
+	}
+	
+	pfree(buffer);
+	
+	return dest;
+}
+
+/* convert a UTF-16LE string into a null-terminated string in the database encoding */
+
+static char* tdsUtf16ToServerEncoding(const unsigned char* src, size_t srclen)
+{
+	char *utf8;
+	char *dest;
+	unsigned char *ptr;
+	size_t i;
+	
+	if (srclen % 2 != 0)
+	{
+		ereport(ERROR,
+			(errcode(ERRCODE_CHARACTER_NOT_IN_REPERTOIRE),
+				errmsg("Invalid UTF-16 string of odd length %lu", (unsigned long) srclen)
+			));
+	}
+	
+	/* each UTF-16 code unit becomes at most 3 bytes of UTF-8 */
+	if ((utf8 = palloc(srclen / 2 * 3 + 1)) == NULL)
+	{
+		ereport(ERROR,
+			(errcode(ERRCODE_FDW_OUT_OF_MEMORY),
+				errmsg("Failed to allocate memory for column value")
+			));
+	}
+	
+	ptr = (unsigned char *) utf8;
+	
+	for (i = 0; i < srclen; i += 2)
+	{
+		pg_wchar c = src[i] | (src[i + 1] << 8);
+		
+		/* most characters are ASCII, which is copied as it is */
+		if (c < 0x80 && c != 0)
+		{
+			*ptr++ = (unsigned char) c;
+			continue;
+		}
+		
+		if (c >= 0xD800 && c <= 0xDBFF)
+		{
+			pg_wchar low;
+			
+			if (i + 3 >= srclen)
+				goto invalid;
+			
+			low = src[i + 2] | (src[i + 3] << 8);
+			
+			if (low < 0xDC00 || low > 0xDFFF)
+				goto invalid;
+			
+			c = 0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00);
+			i += 2;
+		}
+		
+		else if (c >= 0xDC00 && c <= 0xDFFF)
+			goto invalid;
+		
+		else if (c == 0)
+			goto invalid;
+		
+		ptr = unicode_to_utf8(c, ptr);
+		ptr += pg_utf_mblen(ptr);
+	}
+	
+	*ptr = '\0';
+	
+	dest = (char *) pg_do_encoding_conversion((unsigned char *) utf8, ptr - (unsigned char *) utf8,
+		PG_UTF8, GetDatabaseEncoding());
+	
+	if (dest != utf8)
+		pfree(utf8);
+	
+	return dest;
+	
+invalid:
+	ereport(ERROR,
+		(errcode(ERRCODE_CHARACTER_NOT_IN_REPERTOIRE),
+			errmsg("Invalid UTF-16 string in column value")
+		));
+	
+	return NULL;
+}
+
+/* get output for EXPLAIN */
+
+static void tdsExplainForeignScan(ForeignScanState *node, ExplainState *es)
+{
+	TdsFdwExecutionState *festate = (TdsFdwExecutionState *) node->fdw_state;
+	
+	#ifdef DEBUG
+		ereport(NOTICE,
+			(errmsg("----> starting tdsExplainForeignScan")
+			));
+	#endif
+	
+	if (es->verbose && festate)
+	{
+		ExplainPropertyText("Remote query", festate->query, es);
+		
+		if (festate->lazy_query)
+			ExplainPropertyText("Lazy column query", festate->lazy_query, es);
+		
+		if (festate->dialect.product != TDS_PRODUCT_UNKNOWN)
+		{
+			char server[64];
+			
+			snprintf(server, sizeof(server), "%s %i",
+				festate->dialect.product == TDS_PRODUCT_SYBASE ? "Sybase ASE" : "SQL Server",
+				festate->dialect.major_version);
+			ExplainPropertyText("Remote server", server, es);
+		}
+	}
+	
+	/* the local conditions that the scan checks itself are not in the plan, so they are shown here */
+	#if (PG_VERSION_NUM >= 90200)
+	if (festate && festate->lazy_qual_exprs != NIL)
+	{
+		Relation rel = node->ss.ss_currentRelation;
+		Node *quals = (Node *) make_ands_explicit((List *) copyObject(festate->lazy_qual_exprs));
+		List *context = deparse_context_for(RelationGetRelationName(rel), RelationGetRelid(rel));
+		
+		ChangeVarNodes(quals, ((Scan *) node->ss.ps.plan)->scanrelid, 1, 0);
+		ExplainPropertyText("Filter", deparse_expression(quals, context, false, false), es);
+		
+		if (es->analyze && node->ss.ps.instrument)
+		{
+			double nfiltered = node->ss.ps.instrument->nfiltered1;
+			double nloops = node->ss.ps.instrument->nloops;
+			
+			if (nfiltered > 0 || es->format != EXPLAIN_FORMAT_TEXT)
+				ExplainPropertyFloat("Rows Removed by Filter", nloops > 0 ? nfiltered / nloops : 0, 0, es);
+		}
+	}
+	#endif
+	
+	if (es->analyze && festate && festate->ncancels > 0)
+	{
+		ExplainPropertyFloat("Remote cancel time", INSTR_TIME_GET_MILLISEC(festate->cancel_time), 3, es);
+	}
+	
+	#ifdef DEBUG
+		ereport(NOTICE,
+			(errmsg("----> finishing tdsExplainForeignScan")
+			));
+	#endif
+}
+
+/* initialize a scan that sends the query without anything pushed down */
+
+static void tdsRemoteScanInit(TdsFdwRemoteScan* remote_scan)
+{
+	remote_scan->pushdown = false;
+	remote_scan->retrieved_attrs = NIL;
+	remote_scan->remote_exprs = NIL;
+	remote_scan->sort_items = NIL;
+	remote_scan->limit = 0;
+	remote_scan->placeholder_names = NIL;
+	remote_scan->relid = 0;
+	remote_scan->remote_params = NIL;
+	remote_scan->staged_params = NIL;
+	remote_scan->fast_rows = 0;
+	remote_scan->lazy_attrs = NIL;
+	remote_scan->nlazy_quals = 0;
+}
+
+/* get what the planner decided to do on the foreign server */
+
+static void tdsGetRemoteScan(ForeignScanState *node, TdsFdwRemoteScan* remote_scan)
+{
+	List *fdw_private = NIL;
+	
+	tdsRemoteScanInit(remote_scan);
+	
+	#if (PG_VERSION_NUM >= 90200)
+	fdw_private = ((ForeignScan *) node->ss.ps.plan)->fdw_private;
+	#endif
+	
+	if (fdw_private == NIL)
+		return;
+	
+	remote_scan->pushdown = intVal(list_nth(fdw_private, TdsFdwScanPrivatePushdown));
+	remote_scan->retrieved_attrs = (List *) list_nth(fdw_private, TdsFdwScanPrivateRetrievedAttrs);
+	remote_scan->remote_exprs = (List *) list_nth(fdw_private, TdsFdwScanPrivateRemoteExprs);
+	remote_scan->sort_items = (List *) list_nth(fdw_private, TdsFdwScanPrivateSortItems);
+	remote_scan->limit = intVal(list_nth(fdw_private, TdsFdwScanPrivateLimit));
+	remote_scan->placeholder_names = (List *) list_nth(fdw_private, TdsFdwScanPrivatePlaceholderNames);
+	remote_scan->relid = intVal(list_nth(fdw_private, TdsFdwScanPrivateRelid));
+	remote_scan->remote_params = tdsGetRemoteParams(remote_scan->remote_exprs, remote_scan->relid);
+	remote_scan->staged_params = (List *) list_nth(fdw_private, TdsFdwScanPrivateStagedParams);
+	remote_scan->fast_rows = intVal(list_nth(fdw_private, TdsFdwScanPrivateFastRows));
+	remote_scan->lazy_attrs = (List *) list_nth(fdw_private, TdsFdwScanPrivateLazyAttrs);
+	remote_scan->nlazy_quals = intVal(list_nth(fdw_private, TdsFdwScanPrivateLazyQuals));
+}
+
+/*
+ * Compute the values of the parameters of the remote query. The expressions
+ * for the placeholders come first, followed by the parameters used by remote
+ * conditions.
+ */
+
+static void tdsEvaluateParameters(ForeignScanState *node)
+{
+	TdsFdwExecutionState *festate = (TdsFdwExecutionState *) node->fdw_state;
+	ExprContext *econtext = node->ss.ps.ps_ExprContext;
+	int nplaceholder_exprs = list_length(festate->placeholder_names);
+	ListCell *lc;
+	int i;
+	int n = 0;
+	int next_param = festate->nplaceholders;
+	
+	for (i = 0; i < festate->nparams; i++)
+	{
+		festate->params[i].isnull = true;
+	}
+	
+	foreach (lc, festate->param_states)
+	{
+		ExprState *state = (ExprState *) lfirst(lc);
+		TdsFdwParameter *param = NULL;
+		Oid valuetype = exprType((Node *) state->expr);
+		Datum value;
+		bool isnull;
+		
+		if (n < nplaceholder_exprs)
+		{
+			char *name = strVal(list_nth(festate->placeholder_names, n));
+			
+			for (i = 0; i < festate->nplaceholders; i++)
+			{
+				if (strcmp(festate->params[i].name, name) == 0)
+					param = &festate->params[i];
+			}
+			
+			n++;
+			
+			/* the first condition with a value wins, since any of them is enough */
+			if (!param || !param->isnull)
+				continue;
+			
+			value = ExecEvalExpr(state, econtext, &isnull, NULL);
+			
+			/* a value that can't be sent is left out, which finds more rows */
+			if (isnull || !tdsIsParameterValue(value, valuetype))
+				continue;
+		}
+		
+		else
+		{
+			param = &festate->params[next_param++];
+			n++;
+			
+			value = ExecEvalExpr(state, econtext, &isnull, NULL);
+			
+			if (get_element_type(valuetype) != InvalidOid)
+			{
+				tdsGetArrayRange(value, isnull, param, &festate->params[next_param++], &festate->dialect);
+				
+				if (list_member_int(festate->staged_params, n - nplaceholder_exprs))
+					tdsStageArray(festate, n - nplaceholder_exprs, param->typid, value, isnull);
+				
+				continue;
+			}
+			
+			if (!isnull && !tdsIsParameterValue(value, valuetype))
+			{
+				ereport(ERROR,
+					(errcode(ERRCODE_FDW_INVALID_DATA_TYPE),
+						errmsg("The value of parameter %s cannot be sent to the foreign server", param->name)
+					));
+			}
+			
+			if (isnull)
+				continue;
+		}
+		
+		param->value = value;
+		param->valuetype = valuetype;
+		param->isnull = false;
+		
+		#ifdef DEBUG
+			ereport(NOTICE,
+				(errmsg("Parameter %s has a value", param->name)
+				));
+		#endif
+	}
+}
+
+/*
+ * Set the parameters for the smallest and largest values of an array. If the
+ * array has no values, nothing can match, so they are left NULL. If a value
+ * can't be sent, e.g. infinity, the whole range of the type is used. A date is
+ * sent as a datetime to servers without the date type, which starts in 1753.
+ */
+
+static void tdsGetArrayRange(Datum value, bool isnull, TdsFdwParameter *min_param, TdsFdwParameter *max_param,
+	const TdsFdwDialect *dialect)
+{
+	const char *min_date = (strcmp(tdsGetParameterType(DATEOID, dialect), "date") == 0) ? "00010101" : "17530101";
+	ArrayType *array;
+	Oid element_type;
+	TypeCacheEntry *typentry;
+	int16 typlen;
+	bool typbyval;
+	char typalign;
+	Datum *elements;
+	bool *nulls;
+	int nelements;
+	int i;
+	
+	min_param->isnull = true;
+	max_param->isnull = true;
+	
+	if (isnull)
+		return;
+	
+	array = DatumGetArrayTypeP(value);
+	element_type = ARR_ELEMTYPE(array);
+	typentry = lookup_type_cache(element_type, TYPECACHE_CMP_PROC_FINFO);
+	
+	get_typlenbyvalalign(element_type, &typlen, &typbyval, &typalign);
+	deconstruct_array(array, element_type, typlen, typbyval, typalign,
+		&elements, &nulls, &nelements);
+	
+	for (i = 0; i < nelements; i++)
+	{
+		if (nulls[i])
+			continue;
+		
+		if (!tdsIsParameterValue(elements[i], element_type))
+		{
+			min_param->value = CStringGetTextDatum(element_type == DATEOID ? min_date : "0001-01-01T00:00:00");
+			max_param->value = CStringGetTextDatum(element_type == DATEOID ? "99991231" : "9999-12-31T23:59:59.999999");
+			min_param->valuetype = TEXTOID;
+			max_param->valuetype = TEXTOID;
+			min_param->isnull = false;
+			max_param->isnull = false;
+			
+			return;
+		}
+		
+		if (min_param->isnull || DatumGetInt32(FunctionCall2(&typentry->cmp_proc_finfo, elements[i], min_param->value)) < 0)
+		{
+			min_param->value = elements[i];
+			min_param->valuetype = element_type;
+			min_param->isnull = false;
+		}
+		
+		if (max_param->isnull || DatumGetInt32(FunctionCall2(&typentry->cmp_proc_finfo, elements[i], max_param->value)) > 0)
+		{
+			max_param->value = elements[i];
+			max_param->valuetype = element_type;
+			max_param->isnull = false;
+		}
+	}
+	
+	#ifdef DEBUG
+		ereport(NOTICE,
+			(errmsg("Array has %i values", nelements)
+			));
+	#endif
+}
+
+/*
+ * Get the value of a parameter in the form that DB-Library sends, and return its
+ * type. DB-Library keeps pointers to the values until they are sent, so they are
+ * palloc'd.
+ */
+
+static int tdsGetBinaryValue(Oid typid, bool isnull, Datum value, BYTE **data, DBINT *datalen)
+{
+	int type;
+	
+	*data = NULL;
+	*datalen = -1;
+	
+	switch (typid)
+	{
+		case BOOLOID:
+			type = SYBBIT;
+			*data = palloc(sizeof(DBBIT));
+			*(DBBIT *) *data = (!isnull && DatumGetBool(value)) ? 1 : 0;
+			break;
+			
+		case INT2OID:
+			type = SYBINT2;
+			*data = palloc(sizeof(DBSMALLINT));
+			*(DBSMALLINT *) *data = isnull ? 0 : DatumGetInt16(value);
+			break;
+			
+		case INT4OID:
+			type = SYBINT4;
+			*data = palloc(sizeof(DBINT));
+			*(DBINT *) *data = isnull ? 0 : DatumGetInt32(value);
+			break;
+			
+		case INT8OID:
+			type = SYBINT8;
+			*data = palloc(sizeof(DBBIGINT));
+			*(DBBIGINT *) *data = isnull ? 0 : DatumGetInt64(value);
+			break;
+			
+		case FLOAT4OID:
+			type = SYBREAL;
+			*data = palloc(sizeof(DBREAL));
+			*(DBREAL *) *data = isnull ? 0 : DatumGetFloat4(value);
+			break;
+			
+		case FLOAT8OID:
+			type = SYBFLT8;
+			*data = palloc(sizeof(DBFLT8));
+			*(DBFLT8 *) *data = isnull ? 0 : DatumGetFloat8(value);
+			break;
+			
+		/* the rest are converted by the foreign server to the declared type */
+		default:
+			type = XSYBNVARCHAR;
+			
+			if (!isnull)
+			{
+				*data = (BYTE *) tdsGetParameterString(value, typid);
+				*datalen = strlen((char *) *data);
+				
+				/*
+				 * A length of 0 means NULL. Trailing spaces are ignored when
+				 * strings are compared, and text conditions are rechecked locally.
+				 */
+				if (*datalen == 0)
+				{
+					*data = (BYTE *) " ";
+					*datalen = 1;
+				}
+			}
+			
+			break;
+	}
+	
+	return type;
+}
+
+/* add a parameter to the remote procedure call that is being built */
+
+static void tdsAddRpcParameter(DBPROCESS *dbproc, const char *name, Oid typid, bool isnull, Datum value)
+{
+	char *param_name;
+	int type;
+	DBINT datalen;
+	BYTE *data;
+	
+	if ((param_name = palloc(strlen(name) + 2)) == NULL)
+	{
+		ereport(ERROR,
+			(errcode(ERRCODE_FDW_OUT_OF_MEMORY),
+				errmsg("Failed to allocate memory for parameter name")
+			));
+	}
+	
+	sprintf(param_name, "@%s", name);
+	
+	type = tdsGetBinaryValue(typid, isnull, value, &data, &datalen);
+	
+	if (isnull)
+	{
+		data = NULL;
+		datalen = 0;
+	}
+	
+	if (dbrpcparam(dbproc, param_name, 0, type, -1, datalen, data) == FAIL)
+	{
+		ereport(ERROR,
+			(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
+				errmsg("Failed to add parameter %s to remote procedure call", param_name)
+			));
+	}
+}
+
+/*
+ * Copy the values of an array parameter to a temporary table on the foreign
+ * server with the bulk copy API, so that the query can join with them. The table
+ * is created by the first execution, and emptied by the ones after it. Values
+ * that can't be sent, such as infinity, can't match any row there, so they are
+ * left out.
+ */
+
+static void tdsStageArray(TdsFdwExecutionState *festate, int index, Oid element_type, Datum value, bool isnull)
+{
+	int16 typlen;
+	bool typbyval;
+	char typalign;
+	Datum *elements;
+	bool *nulls;
+	int nelements = 0;
+	int nrows = 0;
+	char table_name[32];
+	StringInfoData buf;
+	RETCODE erc;
+	int i;
+	
+	#ifdef DEBUG
+		ereport(NOTICE,
+			(errmsg("----> starting tdsStageArray")
+			));
+	#endif
+	
+	snprintf(table_name, sizeof(table_name), "#fdw_param%d", index);
+	initStringInfo(&buf);
+	
+	if (festate->executions == 0)
+	{
+		appendStringInfo(&buf, "CREATE TABLE %s ([value] %s NOT NULL)", table_name,
+			tdsGetParameterType(element_type, &festate->dialect));
+	}
+	
+	else
+	{
+		appendStringInfo(&buf, "TRUNCATE TABLE %s", table_name);
+	}
+	
+	#ifdef DEBUG
+		ereport(NOTICE,
+			(errmsg("Preparing %s with %s", table_name, buf.data)
+			));
+	#endif
+	
+	if (dbcmd(festate->dbproc, buf.data) == FAIL || dbsqlexec(festate->dbproc) == FAIL)
+	{
+		ereport(ERROR,
+			(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
+				errmsg("Failed to execute query %s", buf.data)
+			));
+	}
+	
+	while ((erc = dbresults(festate->dbproc)) != NO_MORE_RESULTS)
+	{
+		if (erc == FAIL)
+		{
+			ereport(ERROR,
+				(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
+					errmsg("Failed to get results from query %s", buf.data)
+				));
+		}
+	}
+	
+	if (!isnull)
+	{
+		get_typlenbyvalalign(element_type, &typlen, &typbyval, &typalign);
+		deconstruct_array(DatumGetArrayTypeP(value), element_type, typlen, typbyval, typalign,
+			&elements, &nulls, &nelements);
+	}
+	
+	if (nelements == 0)
+		goto cleanup;
+	
+	if (bcp_init(festate->dbproc, table_name, NULL, NULL, DB_IN) == FAIL)
+	{
+		ereport(ERROR,
+			(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
+				errmsg("Failed to start bulk copy to %s", table_name)
+			));
+	}
+	
+	for (i = 0; i < nelements; i++)
+	{
+		BYTE *data;
+		DBINT datalen;
+		int type;
+		
+		if (nulls[i] || !tdsIsParameterValue(elements[i], element_type))
+			continue;
+		
+		type = tdsGetBinaryValue(element_type, false, elements[i], &data, &datalen);
+		
+		/* bulk copy converts from the character types of the client */
+		if (type == XSYBNVARCHAR)
+			type = SYBCHAR;
+		
+		if (bcp_bind(festate->dbproc, data, 0, datalen, NULL, 0, type, 1) == FAIL ||
+			bcp_sendrow(festate->dbproc) == FAIL)
+		{
+			ereport(ERROR,
+				(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
+					errmsg("Failed to copy a value to %s", table_name)
+				));
+		}
+		
+		if (++nrows % STAGING_BATCH_SIZE == 0 && bcp_batch(festate->dbproc) == -1)
+		{
+			ereport(ERROR,
+				(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
+					errmsg("Failed to commit a batch of values to %s", table_name)
+				));
+		}
+	}
+	
+	if (bcp_done(festate->dbproc) == -1)
+	{
+		ereport(ERROR,
+			(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
+				errmsg("Failed to finish bulk copy to %s", table_name)
+			));
+	}
+	
+cleanup:
+	;
+	
+	#ifdef DEBUG
+		ereport(NOTICE,
+			(errmsg("Copied %i values to %s", nrows, table_name)
+			));
+		ereport(NOTICE,
+			(errmsg("----> finishing tdsStageArray")
+			));
+	#endif
+}
+
+/* prepare the query with sp_prepare, so that it is only compiled once */
+
+static void tdsPrepareQuery(TdsFdwExecutionState *festate)
+{
+	char *declarations = tdsGetParameterDeclarations(festate->params, festate->nparams, &festate->dialect);
+	RETCODE erc;
+	
+	#ifdef DEBUG
+		ereport(NOTICE,
+			(errmsg("----> starting tdsPrepareQuery")
+			));
+	#endif
+	
+	if (dbrpcinit(festate->dbproc, "sp_prepare", 0) == FAIL ||
+		dbrpcparam(festate->dbproc, "@handle", DBRPCRETURN, SYBINT4, -1, 0, NULL) == FAIL ||
+		dbrpcparam(festate->dbproc, "@params", 0, XSYBNVARCHAR, -1, strlen(declarations), (BYTE *) declarations) == FAIL ||
+		dbrpcparam(festate->dbproc, "@stmt", 0, XSYBNVARCHAR, -1, strlen(festate->query), (BYTE *) festate->query) == FAIL)
+	{
+		ereport(ERROR,
+			(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
+				errmsg("Failed to set up sp_prepare for query %s", festate->query)
+			));
+	}
+	
+	if (dbrpcsend(festate->dbproc) == FAIL)
+	{
+		ereport(ERROR,
+			(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
+				errmsg("Failed to send sp_prepare for query %s", festate->query)
+			));
+	}
+	
+	/* compiling the query can take a while, so don't block in dbsqlok() */
+	tdsWaitForResponse(festate->dbproc);
+	
+	if (dbsqlok(festate->dbproc) == FAIL)
+	{
+		ereport(ERROR,
+			(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
+				errmsg("Failed to prepare query %s", festate->query)
+			));
+	}
+	
+	/* the handle is returned after any results */
+	while ((erc = dbresults(festate->dbproc)) != NO_MORE_RESULTS)
+	{
+		if (erc == FAIL)
+		{
+			ereport(ERROR,
+				(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
+					errmsg("Failed to get results from sp_prepare for query %s", festate->query)
+				));
+		}
+		
+		while (dbnextrow(festate->dbproc) != NO_MORE_ROWS)
+			;
+	}
+	
+	if (dbnumrets(festate->dbproc) > 0 && dbretlen(festate->dbproc, 1) == sizeof(DBINT))
+	{
+		memcpy(&festate->prepared_handle, dbretdata(festate->dbproc, 1), sizeof(DBINT));
+		festate->prepared = true;
+		
+		#ifdef DEBUG
+			ereport(NOTICE,
+				(errmsg("Prepared handle is %i", festate->prepared_handle)
+				));
+		#endif
+	}
+	
+	#ifdef DEBUG
+		ereport(NOTICE,
+			(errmsg("----> finishing tdsPrepareQuery")
+			));
+	#endif
+}
+
+/*
+ * Send the query with its parameters as a remote procedure call, so the foreign
+ * server can reuse its plan for other values. The first execution uses
+ * sp_executesql. If the scan is run again, e.g. in a nested loop, the query is
+ * prepared once and then run with sp_execute.
+ */
+
+static RETCODE tdsSendParameterizedQuery(TdsFdwExecutionState *festate)
+{
+	int i;
+	
+	if (festate->executions > 0 && !festate->prepared)
+		tdsPrepareQuery(festate);
+	
+	if (festate->prepared)
+	{
+		#ifdef DEBUG
+			ereport(NOTICE,
+				(errmsg("Executing prepared handle %i", festate->prepared_handle)
+				));
+		#endif
+		
+		if (dbrpcinit(festate->dbproc, "sp_execute", 0) == FAIL ||
+			dbrpcparam(festate->dbproc, "@handle", 0, SYBINT4, -1, -1, (BYTE *) &festate->prepared_handle) == FAIL)
+		{
+			ereport(ERROR,
+				(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
+					errmsg("Failed to set up sp_execute for query %s", festate->query)
+				));
+		}
+	}
+	
+	else
+	{
+		char *declarations = tdsGetParameterDeclarations(festate->params, festate->nparams, &festate->dialect);
+		
+		if (dbrpcinit(festate->dbproc, "sp_executesql", 0) == FAIL ||
+			dbrpcparam(festate->dbproc, "@stmt", 0, XSYBNVARCHAR, -1, strlen(festate->query), (BYTE *) festate->query) == FAIL ||
+			dbrpcparam(festate->dbproc, "@params", 0, XSYBNVARCHAR, -1, strlen(declarations), (BYTE *) declarations) == FAIL)
+		{
+			ereport(ERROR,
+				(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
+					errmsg("Failed to set up sp_executesql for query %s", festate->query)
+				));
+		}
+	}
+	
+	for (i = 0; i < festate->nparams; i++)
+	{
+		TdsFdwParameter *param = &festate->params[i];
+		
+		tdsAddRpcParameter(festate->dbproc, param->name, param->isnull ? param->typid : param->valuetype,
+			param->isnull, param->value);
+	}
+	
+	festate->executions++;
+	
+	return dbrpcsend(festate->dbproc);
+}
+
+/*
+ * Send the query to the foreign server, with the values of its parameters. Its
+ * answer is read by tdsWaitForResponse() and dbsqlok().
+ */
+
+static void tdsSendQuery(ForeignScanState *node)
+{
+	TdsFdwExecutionState *festate = (TdsFdwExecutionState *) node->fdw_state;
+	char *query = festate->query;
+	
+	#ifdef DEBUG
+		ereport(NOTICE,
+			(errmsg("----> starting tdsSendQuery")
+			));
+	#endif
+	
+	if (festate->nparams > 0)
+	{
+		/* the values may depend on parameters of the local query, so they are computed now */
+		tdsEvaluateParameters(node);
+		
+		if (tdsDialectHasParameters(&festate->dialect))
+		{
+			#ifdef DEBUG
+				ereport(NOTICE,
+					(errmsg("Executing the query with %i parameters", festate->nparams)
+					));
+			#endif
+			
+			if (tdsSendParameterizedQuery(festate) == FAIL)
+			{
+				ereport(ERROR,
+					(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
+						errmsg("Failed to execute query %s", festate->query)
+					));
+			}
+			
+			festate->sent = true;
+			return;
+		}
+		
+		/* without sp_executesql, the values are declared in a batch that runs the query */
+		query = tdsBuildExecuteSql(festate->query, festate->params, festate->nparams, &festate->dialect);
+	}
+	
+	#ifdef DEBUG
+		ereport(NOTICE,
+			(errmsg("Setting database command to %s", query)
+			));
+	#endif
+	
+	if (dbcmd(festate->dbproc, query) == FAIL)
+	{
+		ereport(ERROR,
+			(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
+				errmsg("Failed to set current query to %s", query)
+			));
+	}
+	
+	#ifdef DEBUG
+		ereport(NOTICE,
+			(errmsg("Executing the query")
+			));
+	#endif
+	
+	if (dbsqlsend(festate->dbproc) == FAIL)
+	{
+		ereport(ERROR,
+			(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
+				errmsg("Failed to execute query %s", query)
+			));
+	}
+	
+	festate->sent = true;
+	
+	#ifdef DEBUG
+		ereport(NOTICE,
+			(errmsg("----> finishing tdsSendQuery")
+			));
+	#endif
+}
+
+#if (PG_VERSION_NUM >= 90200)
+
+/* find a value that is only known while the local query runs */
+
+static bool tdsContainsExecParam(Node *node, void *context)
+{
+	if (node == NULL)
+		return false;
+	
+	if (IsA(node, Param) && ((Param *) node)->paramkind == PARAM_EXEC)
+		return true;
+	
+	if (IsA(node, SubPlan) || IsA(node, AlternativeSubPlan))
+		return true;
+	
+	return expression_tree_walker(node, tdsContainsExecParam, context);
+}
+
+#endif
+
+/*
+ * The query can be sent when the scan begins if the values of its parameters
+ * are already known then, i.e. they don't come from an outer scan or a
+ * subquery. Arrays that are copied to the foreign server need the connection
+ * for that, so those queries wait for the first iteration.
+ */
+
+static bool tdsCanSendAtBegin(ForeignScanState *node)
+{
+	TdsFdwExecutionState *festate = (TdsFdwExecutionState *) node->fdw_state;
+	
+	if (!festate->dbproc || festate->staged_params != NIL)
+		return false;
+	
+	#if (PG_VERSION_NUM >= 90200)
+		if (tdsContainsExecParam((Node *) ((ForeignScan *) node->ss.ps.plan)->fdw_exprs, NULL))
+			return false;
+	#endif
+	
+	return true;
+}
+
+/* initiate access to foreign server and database */
+
+static void tdsBeginForeignScan(ForeignScanState *node, int eflags)
+{
+	TdsFdwOptionSet option_set;
+	TdsFdwRemoteScan remote_scan;
+	LOGINREC *login;
+	DBPROCESS *dbproc;
+	TdsFdwExecutionState *festate;
+	int natts = RelationGetDescr(node->ss.ss_currentRelation)->natts;
+	int i;
+	
+	#ifdef DEBUG
+		ereport(NOTICE,
+			(errmsg("----> starting tdsBeginForeignScan")
+			));
+	#endif
+	
+	tdsGetOptions(RelationGetRelid(node->ss.ss_currentRelation), &option_set);
+	tdsGetRemoteScan(node, &remote_scan);
+	
+	if ((festate = (TdsFdwExecutionState *) palloc0(sizeof(TdsFdwExecutionState))) == NULL)
+	{
+		ereport(ERROR,
+			(errcode(ERRCODE_FDW_OUT_OF_MEMORY),
+				errmsg("Failed to allocate memory for execution state")
+			));
+	}
+	
+	node->fdw_state = (void *) festate;
+	festate->first = 1;
+	festate->row = 0;
+	festate->compressed = NULL;
+	festate->nplaceholders = option_set.nplaceholders;
+	festate->nparams = option_set.nplaceholders + list_length(remote_scan.remote_params);
+	festate->nremote_params = list_length(remote_scan.remote_params);
+	festate->placeholder_names = remote_scan.placeholder_names;
+	festate->staged_params = remote_scan.staged_params;
+	festate->executions = 0;
+	festate->prepared = false;
+	
+	festate->fetch_size = option_set.fetch_size;
+	
+	/*
+	 * Iterate is called in a short-lived context, so what has to last for the
+	 * scan is allocated in the context of the query. The values of a batch of
+	 * rows are allocated in their own context, which is reset before the next
+	 * batch.
+	 */
+	festate->scan_cxt = CurrentMemoryContext;
+	festate->batch_cxt = AllocSetContextCreate(CurrentMemoryContext,
+		"tds_fdw batch data",
+		ALLOCSET_DEFAULT_MINSIZE,
+		ALLOCSET_DEFAULT_INITSIZE,
+		ALLOCSET_DEFAULT_MAXSIZE);
+	
+	/*
+	 * The placeholders, followed by the parameters used by remote conditions.
+	 * An array is sent as the minimum and maximum of its values.
+	 */
+	if (festate->nparams > 0)
+	{
+		ListCell *lc;
+		int n = 1;
+		
+		if ((festate->params = palloc0((festate->nparams + festate->nremote_params) * sizeof(TdsFdwParameter))) == NULL)
+		{
+			ereport(ERROR,
+				(errcode(ERRCODE_FDW_OUT_OF_MEMORY),
+					errmsg("Failed to allocate memory for parameters")
+				));
+		}
+		
+		for (i = 0; i < option_set.nplaceholders; i++)
+		{
+			festate->params[i] = option_set.placeholders[i];
+		}
+		
+		foreach (lc, remote_scan.remote_params)
+		{
+			Oid typid = exprType((Node *) lfirst(lc));
+			Oid element_type = get_element_type(typid);
+			
+			if (element_type != InvalidOid)
+			{
+				festate->params[i].name = palloc(32);
+				snprintf(festate->params[i].name, 32, "fdw_param%d_min", n);
+				festate->params[i].typid = element_type;
+				festate->params[i].isnull = true;
+				i++;
+				
+				festate->params[i].name = palloc(32);
+				snprintf(festate->params[i].name, 32, "fdw_param%d_max", n);
+				festate->params[i].typid = element_type;
+				festate->params[i].isnull = true;
+				i++;
+			}
+			
+			else
+			{
+				festate->params[i].name = palloc(32);
+				snprintf(festate->params[i].name, 32, "fdw_param%d", n);
+				festate->params[i].typid = typid;
+				festate->params[i].isnull = true;
+				i++;
+			}
+			
+			n++;
+		}
+		
+		festate->nparams = i;
+	}
+	
+	#if (PG_VERSION_NUM >= 90200)
+	festate->param_states = (List *) ExecInitExpr((Expr *) ((ForeignScan *) node->ss.ps.plan)->fdw_exprs,
+		(PlanState *) node);
+	
+	/*
+	 * With lazy columns, the local conditions follow the parameters, because
+	 * they have to be checked before the lazy columns are fetched.
+	 */
+	if (remote_scan.nlazy_quals > 0)
+	{
+		int nparam_states = list_length(festate->param_states) - remote_scan.nlazy_quals;
+		
+		festate->lazy_quals = list_copy_tail(festate->param_states, nparam_states);
+		festate->param_states = list_truncate(festate->param_states, nparam_states);
+		festate->lazy_qual_exprs = list_copy_tail(((ForeignScan *) node->ss.ps.plan)->fdw_exprs, nparam_states);
+	}
+	#endif
+	
+	festate->lazy_attrs = remote_scan.lazy_attrs;
+	festate->key_attnum = option_set.key_attnum;
+	
+	/* map the columns of the result to the local columns */
+	if (remote_scan.pushdown)
+	{
+		ListCell *lc;
+		
+		festate->nattnums = list_length(remote_scan.retrieved_attrs);
+		festate->attnums = palloc((festate->nattnums + 1) * sizeof(int));
+		
+		i = 0;
+		
+		foreach (lc, remote_scan.retrieved_attrs)
+		{
+			festate->attnums[i++] = lfirst_int(lc);
+		}
+	}
+	
+	else
+	{
+		festate->nattnums = natts;
+		festate->attnums = palloc((festate->nattnums + 1) * sizeof(int));
+		
+		for (i = 0; i < natts; i++)
+		{
+			festate->attnums[i] = i + 1;
+		}
+	}
+	
+	/* the names of the local columns on the foreign server, for matching the columns of the result */
+	festate->attnames = palloc0((natts + 1) * sizeof(char *));
+	
+	for (i = 0; i < natts; i++)
+	{
+		if (!RelationGetDescr(node->ss.ss_currentRelation)->attrs[i]->attisdropped)
+			festate->attnames[i] = pstrdup(tdsGetColumnName(node->ss.ss_currentRelation, &option_set, i + 1));
+	}
+	
+	/* the input functions of the local columns, for values that are read from text */
+	festate->attinmeta = TupleDescGetAttInMetadata(RelationGetDescr(node->ss.ss_currentRelation));
+	
+	/* EXPLAIN without ANALYZE only needs the query */
+	if (eflags & EXEC_FLAG_EXPLAIN_ONLY)
+	{
+		goto cleanup;
+	}
+		
+	#ifdef DEBUG
+		ereport(NOTICE,
+			(errmsg("Initiating DB-Library")
+			));
+	#endif
+	
+	if (dbinit() == FAIL)
+	{
+		ereport(ERROR,
+			(errcode(ERRCODE_FDW_OUT_OF_MEMORY),
+				errmsg("Failed to initialize DB-Library environment")
+			));
+	}
+	
+	dberrhandle(tds_err_handler);
+	dbmsghandle(tds_msg_handler);
+	
+	#ifdef DEBUG
+		ereport(NOTICE,
+			(errmsg("Getting login structure")
+			));
+	#endif
+	
+	if ((login = dblogin()) == NULL)
+	{
+		ereport(ERROR,
+			(errcode(ERRCODE_FDW_OUT_OF_MEMORY),
+				errmsg("Failed to initialize DB-Library login structure")
+			));
+	}
+	
+	/* the values of some array parameters are copied to the foreign server */
+	if (festate->staged_params != NIL)
+	{
+		BCP_SETL(login, TRUE);
+	}
+	
+	if (tdsSetupConnection(&option_set, login, &dbproc) != 0)
+	{
+		goto cleanup;
+	}
+	
+	festate->login = login;
+	festate->dbproc = dbproc;
+	
+	/* the lazy columns are fetched on a second connection while the rows of the query are read */
+	if (festate->lazy_attrs != NIL)
+	{
+		if (tdsSetupConnection(&option_set, login, &festate->lazy_dbproc) != 0)
+		{
+			ereport(ERROR,
+				(errcode(ERRCODE_FDW_UNABLE_TO_ESTABLISH_CONNECTION),
+					errmsg("Failed to connect to the server for lazy columns")
+				));
+		}
+	}
+	
+cleanup:
+	;
+	
+	/*
+	 * The query is built once the connection has found what the foreign server
+	 * is. EXPLAIN uses what was found for the server when the query was planned.
+	 */
+	festate->dialect = option_set.dialect;
+	
+	/* text that FreeTDS already gives in the encoding of the database does not have to be checked */
+	festate->verify_encoding = !(option_set.character_set &&
+		pg_char_to_encoding(option_set.character_set) == GetDatabaseEncoding());
+	
+	festate->query = tdsBuildQuery(node->ss.ss_currentRelation, &option_set, &remote_scan);
+	
+	if (festate->lazy_attrs != NIL)
+	{
+		festate->lazy_query = tdsBuildLazyQuery(node->ss.ss_currentRelation, &option_set, festate->lazy_attrs);
+	}
+	
+	for (i = 0; i < option_set.nplaceholders; i++)
+	{
+		if (!tdsGetParameterType(option_set.placeholders[i].typid, &option_set.dialect))
+		{
+			ereport(ERROR,
+				(errcode(ERRCODE_FDW_INVALID_DATA_TYPE),
+					errmsg("The type of placeholder %s is not supported by the foreign server", option_set.placeholders[i].name)
+				));
+		}
+	}
+	
+	/* compression is only applied when the columns are named in the query */
+	if ((remote_scan.pushdown || option_set.table) && tdsDialectHasCompress(&option_set.dialect))
+	{
+		for (i = 0; i < option_set.ncolumns; i++)
+		{
+			if (!option_set.columns[i].compress)
+				continue;
+			
+			if (!festate->compressed)
+			{
+				if ((festate->compressed = palloc0(option_set.ncolumns * sizeof(bool))) == NULL)
+				{
+					ereport(ERROR,
+						(errcode(ERRCODE_FDW_OUT_OF_MEMORY),
+							errmsg("Failed to allocate memory for execution state")
+						));
+				}
+			}
+			
+			festate->compressed[i] = true;
+		}
+	}
+	
+	/*
+	 * The query is sent now if it can be, so that the foreign server runs it
+	 * while the rest of the local plan starts. The foreign scans under an
+	 * Append all begin before any of them is read, so their queries run on
+	 * their servers at the same time.
+	 */
+	if (tdsCanSendAtBegin(node))
+	{
+		tdsSendQuery(node);
+	}
+	
+	#ifdef DEBUG
+		ereport(NOTICE,
+			(errmsg("----> finishing tdsBeginForeignScan")
+			));
+	#endif
+}
+
+/*
+ * wait for the foreign server to answer a query that was sent. DB-Library would
+ * block in the socket until then, which can be for as long as the query runs,
+ * so the socket is polled here and the backend can still be canceled. The query
+ * is canceled on the foreign server too.
+ */
+
+static void tdsWaitForResponse(DBPROCESS *dbproc)
+{
+	int sock = dbiordesc(dbproc);
+	
+	if (sock < 0)
+		return;
+	
+	for (;;)
+	{
+		struct pollfd pfd;
+		int ret_value;
+		
+		pfd.fd = sock;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		
+		ret_value = poll(&pfd, 1, RESPONSE_POLL_INTERVAL);
+		
+		/* anything but an answer or a timeout is left for DB-Library to report */
+		if (ret_value > 0 || (ret_value < 0 && errno != EINTR))
+			break;
+		
+		if (QueryCancelPending || ProcDiePending)
+		{
+			#ifdef DEBUG
+				ereport(NOTICE,
+					(errmsg("Canceling the query on the foreign server")
+					));
+			#endif
+			
+			dbcancel(dbproc);
+			CHECK_FOR_INTERRUPTS();
+			
+			ereport(ERROR,
+				(errcode(ERRCODE_QUERY_CANCELED),
+					errmsg("Canceled the query on the foreign server")
+				));
+		}
+	}
+}
+
+/*
+ * cancel the query on the foreign server and throw away the rows that it has
+ * not sent yet, so that the connection can run the query again. This is timed,
+ * so that EXPLAIN ANALYZE can show how long rescans spent on it. A scan that
+ * ends is not canceled, since its connection is closed anyway.
+ */
+
+static void tdsCancelQuery(TdsFdwExecutionState *festate)
+{
+	instr_time start;
+	instr_time duration;
+	
+	#ifdef DEBUG
+		ereport(NOTICE,
+			(errmsg("Canceling the rest of the query")
+			));
+	#endif
+	
+	INSTR_TIME_SET_CURRENT(start);
+	dbcancel(festate->dbproc);
+	INSTR_TIME_SET_CURRENT(duration);
+	INSTR_TIME_SUBTRACT(duration, start);
+	INSTR_TIME_ADD(festate->cancel_time, duration);
+	
+	festate->ncancels++;
+	festate->sent = false;
+}
+
+/* get next row from foreign table */
+
+static TupleTableSlot* tdsIterateForeignScan(ForeignScanState *node)
+{
+	RETCODE erc;
+	TdsFdwExecutionState *festate = (TdsFdwExecutionState *) node->fdw_state;
+	TupleTableSlot *slot = node->ss.ss_ScanTupleSlot;
+	int natts = RelationGetDescr(node->ss.ss_currentRelation)->natts;
+	
+	/* Cleanup */
+	ExecClearTuple(slot);
+	
+	#ifdef DEBUG
+		ereport(NOTICE,
+			(errmsg("----> starting tdsIterateForeignScan")
+			));
+	#endif
+	
+	if (festate->first)
+	{
+		#ifdef DEBUG
+			ereport(NOTICE,
+				(errmsg("This is the first iteration")
+				));
+		#endif
+		
+		festate->first = 0;
+		
+		/* the query may have been sent when the scan began */
+		if (!festate->sent)
+			tdsSendQuery(node);
+		
+		festate->sent = false;
+		tdsWaitForResponse(festate->dbproc);
+		
+		if ((erc = dbsqlok(festate->dbproc)) == FAIL)
+		{
+			ereport(ERROR,
+				(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
+					errmsg("Failed to execute query %s", festate->query)
+				));
+		}
+		
+		#ifdef DEBUG
+			ereport(NOTICE,
+				(errmsg("Query executed correctly")
+				));
+			ereport(NOTICE,
+				(errmsg("Getting results")
+				));				
+		#endif
+
+		erc = dbresults(festate->dbproc);
+		
+		if (erc == FAIL)
+		{
+			ereport(ERROR,
+				(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
+					errmsg("Failed to get results from query %s", festate->query)
+				));
+		}
+		
+		else if (erc == NO_MORE_RESULTS)
+		{
+			ereport(ERROR,
+				(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
+					errmsg("There appears to be no results from query %s", festate->query)
+				));
+		}
+		
+		else if (erc == SUCCEED)
+		{
+			#ifdef DEBUG
+				ereport(NOTICE,
+					(errmsg("Successfully got results")
+					));
+			#endif
+			
+			/* every execution of the query returns the same columns */
+			if (!festate->columns)
+			{
+				MemoryContext oldcontext = MemoryContextSwitchTo(festate->scan_cxt);
+				
+				tdsGetColumns(node);
+				MemoryContextSwitchTo(oldcontext);
+			}
+		}
+		
+		else
+		{
+			ereport(ERROR,
+				(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
+					errmsg("Unknown return code getting results from query %s", festate->query)
+				));
+		}
+	}
+	
+	/*
+	 * rows are decoded a batch at a time, and then returned from the batch. A
+	 * batch can be left empty when local conditions are checked here.
+	 */
+	while (festate->batch_next >= festate->batch_nrows && !festate->batch_done)
+	{
+		tdsFetchBatch(node);
+	}
+	
+	if (festate->batch_next < festate->batch_nrows)
+	{
+		int offset = festate->batch_next++ * natts;
+		
+		/* the values stay in the batch, so the slot only has to point to them */
+		memcpy(slot->tts_values, &festate->batch_values[offset], natts * sizeof(Datum));
+		memcpy(slot->tts_isnull, &festate->batch_nulls[offset], natts * sizeof(bool));
+		ExecStoreVirtualTuple(slot);
+	}
+	
+	else
+	{
+		#ifdef DEBUG
+			ereport(NOTICE,
+				(errmsg("No more rows")
+				));
+		#endif
+	}
+	
+	#ifdef DEBUG
+		ereport(NOTICE,
+			(errmsg("----> finishing tdsIterateForeignScan")
+			));
+	#endif
+
+	return slot;
+}
+
+/*
+ * read and decode the next batch of rows. The rows of the last batch have all
+ * been returned, so their values are freed.
+ */
+
+static void tdsFetchBatch(ForeignScanState *node)
+{
+	TdsFdwExecutionState *festate = (TdsFdwExecutionState *) node->fdw_state;
+	int natts = RelationGetDescr(node->ss.ss_currentRelation)->natts;
+	MemoryContext oldcontext;
+	int ret_code;
+	Size batch_bytes = 0;
+	
+	#ifdef DEBUG
+		ereport(NOTICE,
+			(errmsg("----> starting tdsFetchBatch")
+			));
+	#endif
+	
+	MemoryContextReset(festate->batch_cxt);
+	oldcontext = MemoryContextSwitchTo(festate->batch_cxt);
+	
+	festate->batch_nrows = 0;
+	festate->batch_next = 0;
+	
+	/* a batch also ends early when long values have filled its memory */
+	while (festate->batch_nrows < festate->batch_rows && batch_bytes < BATCH_MEMORY_SIZE)
+	{
+		Datum *values = &festate->batch_values[festate->batch_nrows * natts];
+		bool *nulls = &festate->batch_nulls[festate->batch_nrows * natts];
+		int ncol;
+		
+		#ifdef DEBUG
+			ereport(NOTICE,
+				(errmsg("Fetching next row")
+				));
+		#endif
+		
+		if ((ret_code = dbnextrow(festate->dbproc)) == NO_MORE_ROWS)
+		{
+			festate->batch_done = true;
+			break;
+		}
+		
+		switch (ret_code)
+		{
+			case REG_ROW:
+				festate->row++;
+				festate->batch_nrows++;
+				
+				#ifdef DEBUG
+					ereport(NOTICE,
+						(errmsg("Row %i fetched", festate->row)
+						));
+				#endif
+				
+				/* columns that are not retrieved are NULL */
+				memset(nulls, true, natts * sizeof(bool));
+				
+				for (ncol = 0; ncol < festate->ncols; ncol++)
+				{
+					COL *column = &festate->columns[ncol];
+					DBINT srclen;
+					BYTE* src;
+					
+					if (column->attnum == 0)
+						continue;
+					
+					srclen = dbdatlen(festate->dbproc, ncol + 1);
+					src = dbdata(festate->dbproc, ncol + 1);
+					
+					#ifdef DEBUG
+						ereport(NOTICE,
+							(errmsg("Fetching column %i (%s), with data length %i", ncol, column->name, srclen)
+							));
+					#endif
+					
+					if (srclen == 0 || src == NULL)
+						continue;
+					
+					nulls[column->attnum - 1] = false;
+					values[column->attnum - 1] = column->decoder(festate, column, src, srclen, &nulls[column->attnum - 1]);
+					batch_bytes += srclen;
+				}
+				
+				#ifdef DEBUG
+					ereport(NOTICE,
+						(errmsg("Printing all %i values", natts)
+						));
+								
+					for (ncol = 0; ncol < natts; ncol++)
+					{
+						ereport(NOTICE,
+							(errmsg("values[%i]: %s", ncol, nulls[ncol] ? "NULL" : "not NULL")
+							));
+					}
+				#endif
+				
+				break;
+				
+			case BUF_FULL:
+				ereport(ERROR,
+					(errcode(ERRCODE_FDW_OUT_OF_MEMORY),
+					errmsg("Buffer filled up during query")
+					));
+				break;
+					
+			case FAIL:
+				ereport(ERROR,
+					(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
+					errmsg("Failed to get row during query")
+					));
+				break;
+			
+			default:
+				ereport(ERROR,
+					(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
+					errmsg("Failed to get row during query. Unknown return code.")
+					));
+		}
+	}
+	
+	/* the lazy columns are only fetched for the rows that are returned */
+	if (festate->lazy_quals != NIL)
+	{
+		tdsFilterBatch(node);
+	}
+	
+	if (festate->lazy_dbproc && festate->batch_nrows > 0)
+	{
+		tdsFetchLazyColumns(node);
+	}
+	
+	MemoryContextSwitchTo(oldcontext);
+	
+	#ifdef DEBUG
+		ereport(NOTICE,
+			(errmsg("%i rows fetched in the batch", festate->batch_nrows)
+			));
+		ereport(NOTICE,
+			(errmsg("----> finishing tdsFetchBatch")
+			));
+	#endif
+}
+
+/*
+ * check the local conditions of the rows of a batch, and keep the rows that
+ * pass them. This is done here instead of by the executor when there are lazy
+ * columns, so that they are not fetched for rows that are thrown away.
+ */
+
+static void tdsFilterBatch(ForeignScanState *node)
+{
+	TdsFdwExecutionState *festate = (TdsFdwExecutionState *) node->fdw_state;
+	TupleTableSlot *slot = node->ss.ss_ScanTupleSlot;
+	ExprContext *econtext = node->ss.ps.ps_ExprContext;
+	int natts = RelationGetDescr(node->ss.ss_currentRelation)->natts;
+	int nrows = 0;
+	int i;
+	
+	econtext->ecxt_scantuple = slot;
+	
+	for (i = 0; i < festate->batch_nrows; i++)
+	{
+		Datum *values = &festate->batch_values[i * natts];
+		bool *nulls = &festate->batch_nulls[i * natts];
+		
+		ExecClearTuple(slot);
+		memcpy(slot->tts_values, values, natts * sizeof(Datum));
+		memcpy(slot->tts_isnull, nulls, natts * sizeof(bool));
+		ExecStoreVirtualTuple(slot);
+		
+		if (!ExecQual(festate->lazy_quals, econtext, false))
+			continue;
+		
+		if (nrows != i)
+		{
+			memcpy(&festate->batch_values[nrows * natts], values, natts * sizeof(Datum));
+			memcpy(&festate->batch_nulls[nrows * natts], nulls, natts * sizeof(bool));
+		}
+		
+		nrows++;
+	}
+	
+	ExecClearTuple(slot);
+	
+	#ifdef DEBUG
+		ereport(NOTICE,
+			(errmsg("%i of %i rows passed the local conditions", nrows, festate->batch_nrows)
+			));
+	#endif
+	
+	#if (PG_VERSION_NUM >= 90200)
+	InstrCountFiltered1(node, festate->batch_nrows - nrows);
+	#endif
+	
+	festate->batch_nrows = nrows;
+}
+
+/*
+ * fetch the lazy columns of the rows of a batch, by looking up their keys on
+ * the foreign server. Every row must be found, since its lazy columns would
+ * otherwise be wrong.
+ */
+
+static void tdsFetchLazyColumns(ForeignScanState *node)
+{
+	TdsFdwExecutionState *festate = (TdsFdwExecutionState *) node->fdw_state;
+	TupleDesc tupdesc = RelationGetDescr(node->ss.ss_currentRelation);
+	Form_pg_attribute key_attr = tupdesc->attrs[festate->key_attnum - 1];
+	int natts = tupdesc->natts;
+	int key = festate->key_attnum - 1;
+	bool *found;
+	int first_row;
+	int i;
+	
+	#ifdef DEBUG
+		ereport(NOTICE,
+			(errmsg("----> starting tdsFetchLazyColumns")
+			));
+	#endif
+	
+	found = palloc0(festate->batch_nrows * sizeof(bool));
+	
+	for (first_row = 0; first_row < festate->batch_nrows; first_row += LAZY_LOOKUP_KEYS)
+	{
+		tdsLookupLazyColumns(node, first_row, Min(first_row + LAZY_LOOKUP_KEYS, festate->batch_nrows), found);
+	}
+	
+	for (i = 0; i < festate->batch_nrows; i++)
+	{
+		Oid typoutput;
+		bool typisvarlena;
+		
+		if (found[i])
+			continue;
+		
+		getTypeOutputInfo(key_attr->atttypid, &typoutput, &typisvarlena);
+		
+		ereport(ERROR,
+			(errcode(ERRCODE_FDW_ERROR),
+				errmsg("Failed to fetch the lazy columns of the row with key %s",
+					OidOutputFunctionCall(typoutput, festate->batch_values[i * natts + key])),
+				errhint("The key column must be unique and not changed on the foreign server while it is read")
+			));
+	}
+	
+	#ifdef DEBUG
+		ereport(NOTICE,
+			(errmsg("----> finishing tdsFetchLazyColumns")
+			));
+	#endif
+}
+
+/*
+ * look up the lazy columns of some rows of the batch, and set found for the
+ * rows that got them. The keys are parameters of sp_executesql when the foreign
+ * server has it, so they are compared with their exact values. Otherwise they
+ * are written into the query, which only works for values that have a literal.
+ */
+
+static void tdsLookupLazyColumns(ForeignScanState *node, int first_row, int end_row, bool *found)
+{
+	TdsFdwExecutionState *festate = (TdsFdwExecutionState *) node->fdw_state;
+	TupleDesc tupdesc = RelationGetDescr(node->ss.ss_currentRelation);
+	Form_pg_attribute key_attr = tupdesc->attrs[festate->key_attnum - 1];
+	int natts = tupdesc->natts;
+	int key = festate->key_attnum - 1;
+	int nlazy_columns = list_length(festate->lazy_attrs) + 1;
+	bool use_params = tdsDialectHasParameters(&festate->dialect) &&
+		tdsGetParameterType(key_attr->atttypid, &festate->dialect) != NULL;
+	TdsFdwParameter *params = NULL;
+	StringInfoData buf;
+	Datum *lazy_values;
+	bool *lazy_nulls;
+	int nkeys = 0;
+	int ret_code;
+	int i;
+	
+	initStringInfo(&buf);
+	appendStringInfoString(&buf, festate->lazy_query);
+	
+	if (use_params)
+		params = palloc0((end_row - first_row) * sizeof(TdsFdwParameter));
+	
+	for (i = first_row; i < end_row; i++)
+	{
+		Datum value = festate->batch_values[i * natts + key];
+		
+		if (festate->batch_nulls[i * natts + key])
+		{
+			ereport(ERROR,
+				(errcode(ERRCODE_FDW_ERROR),
+					errmsg("Failed to fetch lazy columns, because key column %s is NULL", NameStr(key_attr->attname))
+				));
+		}
+		
+		if (use_params ? !tdsIsParameterValue(value, key_attr->atttypid) : !tdsIsPushableValue(value, key_attr->atttypid))
+		{
+			Oid typoutput;
+			bool typisvarlena;
+			
+			getTypeOutputInfo(key_attr->atttypid, &typoutput, &typisvarlena);
+			
+			ereport(ERROR,
+				(errcode(ERRCODE_FDW_INVALID_ATTRIBUTE_VALUE),
+					errmsg("Failed to fetch lazy columns, because key %s can't be sent to the foreign server",
+						OidOutputFunctionCall(typoutput, value))
+				));
+		}
+		
+		if (nkeys > 0)
+			appendStringInfoString(&buf, ", ");
+		
+		if (use_params)
+		{
+			params[nkeys].name = palloc(32);
+			snprintf(params[nkeys].name, 32, "fdw_key%d", nkeys + 1);
+			params[nkeys].typid = key_attr->atttypid;
+			params[nkeys].valuetype = key_attr->atttypid;
+			params[nkeys].value = value;
+			params[nkeys].isnull = false;
+			appendStringInfo(&buf, "@%s", params[nkeys].name);
+		}
+		
+		else
+		{
+			tdsAppendValue(&buf, value, key_attr->atttypid);
+		}
+		
+		nkeys++;
+	}
+	
+	appendStringInfoChar(&buf, ')');
+	
+	#ifdef DEBUG
+		ereport(NOTICE,
+			(errmsg("Fetching lazy columns of %i rows with %s", nkeys, buf.data)
+			));
+	#endif
+	
+	if (use_params)
+	{
+		char *declarations = tdsGetParameterDeclarations(params, nkeys, &festate->dialect);
+		
+		if (dbrpcinit(festate->lazy_dbproc, "sp_executesql", 0) == FAIL ||
+			dbrpcparam(festate->lazy_dbproc, "@stmt", 0, XSYBNVARCHAR, -1, strlen(buf.data), (BYTE *) buf.data) == FAIL ||
+			dbrpcparam(festate->lazy_dbproc, "@params", 0, XSYBNVARCHAR, -1, strlen(declarations), (BYTE *) declarations) == FAIL)
+		{
+			ereport(ERROR,
+				(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
+					errmsg("Failed to set up sp_executesql for query %s", buf.data)
+				));
+		}
+		
+		for (i = 0; i < nkeys; i++)
+		{
+			tdsAddRpcParameter(festate->lazy_dbproc, params[i].name, params[i].typid, false, params[i].value);
+		}
+		
+		if (dbrpcsend(festate->lazy_dbproc) == FAIL)
+		{
+			ereport(ERROR,
+				(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
+					errmsg("Failed to send query %s", buf.data)
+				));
+		}
+	}
+	
+	else if (dbcmd(festate->lazy_dbproc, buf.data) == FAIL || dbsqlsend(festate->lazy_dbproc) == FAIL)
+	{
+		ereport(ERROR,
+			(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
+				errmsg("Failed to send query %s", buf.data)
+			));
+	}
+	
+	tdsWaitForResponse(festate->lazy_dbproc);
+	
+	if (dbsqlok(festate->lazy_dbproc) == FAIL || dbresults(festate->lazy_dbproc) != SUCCEED)
+	{
+		ereport(ERROR,
+			(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
+				errmsg("Failed to execute query %s", buf.data)
+			));
+	}
+	
+	if (!festate->lazy_columns)
+	{
+		MemoryContext oldcontext = MemoryContextSwitchTo(festate->scan_cxt);
+		
+		tdsGetLazyColumns(node);
+		MemoryContextSwitchTo(oldcontext);
+	}
+	
+	lazy_values = palloc(nlazy_columns * sizeof(Datum));
+	lazy_nulls = palloc(nlazy_columns * sizeof(bool));
+	
+	while ((ret_code = dbnextrow(festate->lazy_dbproc)) != NO_MORE_ROWS)
+	{
+		int ncol;
+		
+		if (ret_code != REG_ROW)
+		{
+			ereport(ERROR,
+				(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
+					errmsg("Failed to get row during query %s", buf.data)
+				));
+		}
+		
+		for (ncol = 0; ncol < nlazy_columns; ncol++)
+		{
+			COL *column = &festate->lazy_columns[ncol];
+			DBINT srclen = dbdatlen(festate->lazy_dbproc, ncol + 1);
+			BYTE *src = dbdata(festate->lazy_dbproc, ncol + 1);
+			
+			lazy_nulls[ncol] = (srclen == 0 || src == NULL);
+			
+			if (!lazy_nulls[ncol])
+				lazy_values[ncol] = column->decoder(festate, column, src, srclen, &lazy_nulls[ncol]);
+		}
+		
+		if (lazy_nulls[0])
+			continue;
+		
+		/* the keys were decoded the same way, so equal keys have the same bytes */
+		for (i = first_row; i < end_row; i++)
+		{
+			Datum *values = &festate->batch_values[i * natts];
+			bool *nulls = &festate->batch_nulls[i * natts];
+			
+			if (!datumIsEqual(values[key], lazy_values[0], key_attr->attbyval, key_attr->attlen))
+				continue;
+			
+			for (ncol = 1; ncol < nlazy_columns; ncol++)
+			{
+				int attnum = festate->lazy_columns[ncol].attnum;
+				
+				values[attnum - 1] = lazy_values[ncol];
+				nulls[attnum - 1] = lazy_nulls[ncol];
+			}
+			
+			found[i] = true;
+		}
+	}
+	
+	/* leave the connection ready for the next lookup */
+	while (dbresults(festate->lazy_dbproc) == SUCCEED)
+	{
+		while (dbnextrow(festate->lazy_dbproc) != NO_MORE_ROWS)
+			;
+	}
+}
+
+/* map the columns of the query for lazy columns, which are the key followed by the lazy columns */
+
+static void tdsGetLazyColumns(ForeignScanState *node)
+{
+	TdsFdwExecutionState *festate = (TdsFdwExecutionState *) node->fdw_state;
+	TupleDesc tupdesc = RelationGetDescr(node->ss.ss_currentRelation);
+	int nlazy_columns = list_length(festate->lazy_attrs) + 1;
+	int ncol;
+	
+	if (dbnumcols(festate->lazy_dbproc) != nlazy_columns)
+	{
+		ereport(ERROR,
+			(errcode(ERRCODE_FDW_INVALID_COLUMN_NUMBER),
+				errmsg("The query for lazy columns returned %i columns instead of %i",
+					dbnumcols(festate->lazy_dbproc), nlazy_columns)
+			));
+	}
+	
+	festate->lazy_columns = palloc0((nlazy_columns + 1) * sizeof(COL));
+	
+	for (ncol = 0; ncol < nlazy_columns; ncol++)
+	{
+		COL *column = &festate->lazy_columns[ncol];
+		
+		column->name = dbcolname(festate->lazy_dbproc, ncol + 1);
+		column->type = dbcoltype(festate->lazy_dbproc, ncol + 1);
+		column->size = dbcollen(festate->lazy_dbproc, ncol + 1);
+		column->attnum = (ncol == 0) ? festate->key_attnum : list_nth_int(festate->lazy_attrs, ncol - 1);
+		column->typid = tupdesc->attrs[column->attnum - 1]->atttypid;
+		column->decoder = tdsGetColumnDecoder(festate, column);
+	}
+}
+
+/* rescan foreign table */
+
+static void tdsReScanForeignScan(ForeignScanState *node)
+{
+	TdsFdwExecutionState *festate = (TdsFdwExecutionState *) node->fdw_state;
+	
+	#ifdef DEBUG
+		ereport(NOTICE,
+			(errmsg("----> starting tdsReScanForeignScan")
+			));
+	#endif
+	
+	/* throw away the rest of the results, and run the query again on the next iteration */
+	if (festate->dbproc && !festate->first)
+	{
+		tdsCancelQuery(festate);
+	}
+	
+	festate->first = 1;
+	festate->row = 0;
+	festate->batch_nrows = 0;
+	festate->batch_next = 0;
+	festate->batch_done = false;
+	
+	#ifdef DEBUG
+		ereport(NOTICE,
+			(errmsg("----> finishing tdsReScanForeignScan")
+			));
+	#endif
+}
+
+/* cleanup objects related to scan */
+
+static void tdsEndForeignScan(ForeignScanState *node)
+{
+	TdsFdwExecutionState *festate = (TdsFdwExecutionState *) node->fdw_state;
+	
+	#ifdef DEBUG
+		ereport(NOTICE,
+			(errmsg("----> starting tdsEndForeignScan")
+			));
+	#endif
+	
+	if (festate->query)
+	{
+		pfree(festate->query);
+	}
+	
+	/* there is no connection for EXPLAIN without ANALYZE */
+	if (!festate->dbproc)
+	{
+		goto cleanup;
+	}
+	
+	#ifdef DEBUG
+		ereport(NOTICE,
+			(errmsg("Closing database connection")
+			));
+	#endif
+	
+	dbclose(festate->dbproc);
+	
+	if (festate->lazy_dbproc)
+	{
+		dbclose(festate->lazy_dbproc);
+	}
+	
+	#ifdef DEBUG
+		ereport(NOTICE,
+			(errmsg("Freeing login structure")
+			));
+	#endif	
+	
+	dbloginfree(festate->login);
+	
+	#ifdef DEBUG
+		ereport(NOTICE,
+			(errmsg("Closing DB-Library")
+			));
+	#endif
+	
+	dbexit();
+	
+cleanup:
+	;
+	
+	#ifdef DEBUG
+		ereport(NOTICE,
+			(errmsg("----> finishing tdsEndForeignScan")
+			));
+	#endif
+}
+
+/* routines for 9.2.0+ */
+#if (PG_VERSION_NUM >= 90200)
+
+static void tdsGetForeignRelSize(PlannerInfo *root, RelOptInfo *baserel, Oid foreigntableid)
+{
+	TdsFdwOptionSet option_set;
+	TdsFdwRemoteScan remote_scan;
+	TdsFdwRelationInfo *fpinfo;
+	LOGINREC *login;
+	DBPROCESS *dbproc;
+	Relation rel;
+	ListCell *lc;
+	
+	#ifdef DEBUG
+		ereport(NOTICE,
+			(errmsg("----> starting tdsGetForeignRelSize")
+			));
+	#endif
+	
+	if ((fpinfo = (TdsFdwRelationInfo *) palloc0(sizeof(TdsFdwRelationInfo))) == NULL)
+	{
+		ereport(ERROR,
+			(errcode(ERRCODE_FDW_OUT_OF_MEMORY),
+				errmsg("Failed to allocate memory for planner information")
+			));
+	}
+	
+	baserel->fdw_private = (void *) fpinfo;
+	
+	tdsGetOptions(foreigntableid, &fpinfo->option_set);
+	
+	/* a query can only be filtered if it can be used as a derived table */
+	fpinfo->pushdown = !fpinfo->option_set.query || fpinfo->option_set.derived_table;
+	
+	/* the row count is taken from the query without any conditions */
+	option_set = fpinfo->option_set;
+	tdsRemoteScanInit(&remote_scan);
+		
+	#ifdef DEBUG
+		ereport(NOTICE,
+			(errmsg("Initiating DB-Library")
+			));
+	#endif
+	
+	if (dbinit() == FAIL)
+	{
+		ereport(ERROR,
+			(errcode(ERRCODE_FDW_OUT_OF_MEMORY),
+				errmsg("Failed to initialize DB-Library environment")
+			));
+		goto cleanup_before_init;
+	}
+	
+	dberrhandle(tds_err_handler);
+	dbmsghandle(tds_msg_handler);
+	
+	#ifdef DEBUG
+		ereport(NOTICE,
+			(errmsg("Getting login structure")
+			));
+	#endif
+	
+	if ((login = dblogin()) == NULL)
+	{
+		ereport(ERROR,
+			(errcode(ERRCODE_FDW_OUT_OF_MEMORY),
+				errmsg("Failed to initialize DB-Library login structure")
+			));
+		goto cleanup_before_login;
+	}
+	
+	if (tdsSetupConnection(&option_set, login, &dbproc) != 0)
+	{
+		goto cleanup;
+	}
+	
+	/* which conditions can be sent depends on what the foreign server is */
+	fpinfo->option_set.dialect = option_set.dialect;
+	
+	foreach (lc, baserel->baserestrictinfo)
+	{
+		RestrictInfo *rinfo = (RestrictInfo *) lfirst(lc);
+		bool recheck = false;
+		
+		if (fpinfo->pushdown && tdsIsForeignExpr(baserel, rinfo->clause, &recheck))
+		{
+			fpinfo->remote_conds = lappend(fpinfo->remote_conds, rinfo);
+			
+			if (recheck)
+				fpinfo->local_conds = lappend(fpinfo->local_conds, rinfo);
+		}
+		
+		else
+		{
+			fpinfo->local_conds = lappend(fpinfo->local_conds, rinfo);
+		}
+	}
+	
+	/* the columns needed by the query above this scan, and by local conditions */
+	pull_varattnos((Node *) baserel->reltargetlist, baserel->relid, &fpinfo->attrs_used);
+	
+	foreach (lc, fpinfo->local_conds)
+	{
+		RestrictInfo *rinfo = (RestrictInfo *) lfirst(lc);
+		
+		pull_varattnos((Node *) rinfo->clause, baserel->relid, &fpinfo->attrs_used);
+	}
+	
+	#ifdef DEBUG
+		ereport(NOTICE,
+			(errmsg("%i conditions can be sent to the foreign server, and %i are checked locally",
+				list_length(fpinfo->remote_conds), list_length(fpinfo->local_conds))
+			));
+	#endif
+	
+	rel = heap_open(foreigntableid, NoLock);
+	option_set.query = tdsBuildQuery(rel, &option_set, &remote_scan);
+	heap_close(rel, NoLock);
+	
+	/* without any conditions, every placeholder is NULL */
+	if (option_set.nplaceholders > 0)
+		option_set.query = tdsBuildExecuteSql(option_set.query, option_set.placeholders, option_set.nplaceholders,
+			&option_set.dialect);
+		
+	baserel->tuples = tdsGetRowCount(&option_set, login, dbproc);
+	baserel->rows = clamp_row_est(baserel->tuples *
+		clauselist_selectivity(root, baserel->baserestrictinfo, 0, JOIN_INNER, NULL));
+	
+cleanup:
+	dbclose(dbproc);
+	dbloginfree(login);
+		
+cleanup_before_login:
+	dbexit();
+	
+cleanup_before_init:
+	;
+	
+	#ifdef DEBUG
+		ereport(NOTICE,
+			(errmsg("----> finishing tdsGetForeignRelSize")
+			));
+	#endif	
+}
+
+static void tdsEstimateCosts(PlannerInfo *root, RelOptInfo *baserel, Cost *startup_cost, Cost *total_cost, Oid foreigntableid)
+{
+	TdsFdwOptionSet option_set;
+	
+	#ifdef DEBUG
+		ereport(NOTICE,
+			(errmsg("----> starting tdsEstimateCosts")
+			));
+	#endif
+	
+	tdsGetOptions(foreigntableid, &option_set);	
+	
+	*startup_cost = tdsGetStartupCost(&option_set);
+		
+	*total_cost = baserel->rows + *startup_cost;
+	
+	#ifdef DEBUG
+		ereport(NOTICE,
+			(errmsg("----> finishing tdsEstimateCosts")
+			));
+	#endif
+}
+
+static void tdsGetForeignPaths(PlannerInfo *root, RelOptInfo *baserel, Oid foreigntableid)
+{
+	TdsFdwRelationInfo *fpinfo = (TdsFdwRelationInfo *) baserel->fdw_private;
+	Cost startup_cost;
+	Cost total_cost;
+	Cost eager_cost;
+	List *lazy_attrs = NIL;
+	List *late_attrs = NIL;
+	
+	#ifdef DEBUG
+		ereport(NOTICE,
+			(errmsg("----> starting tdsGetForeignPaths")
+			));
+	#endif
+	
+	tdsEstimateCosts(root, baserel, &startup_cost, &total_cost, foreigntableid);
+	eager_cost = total_cost;
+	
+	if (fpinfo->pushdown)
+	{
+		List *retrieved_attrs = tdsGetRetrievedAttrs(fpinfo);
+		List *local_exprs = extract_actual_clauses(fpinfo->local_conds, false);
+		
+		lazy_attrs = tdsGetLazyAttrs(root, baserel, fpinfo, retrieved_attrs, local_exprs, false);
+		late_attrs = tdsGetLazyAttrs(root, baserel, fpinfo, retrieved_attrs, local_exprs, true);
+	}
+	
+	/* the lazy columns are always fetched by key */
+	if (lazy_attrs != NIL)
+	{
+		total_cost += tdsGetLazyFetchCost(root, baserel, fpinfo, lazy_attrs);
+	}
+	
+	add_path(baserel, 
+		(Path *) create_foreignscan_path(root, baserel, baserel->rows, startup_cost, total_cost,
+			NIL, NULL, NIL));
+	
+	/* the foreign server can also sort the rows, if the query needs them sorted */
+	if (fpinfo->pushdown && root->query_pathkeys != NIL &&
+		tdsGetSortItems(baserel, root->query_pathkeys) != NIL)
+	{
+		#ifdef DEBUG
+			ereport(NOTICE,
+				(errmsg("Adding path sorted by the foreign server")
+				));
+		#endif
+		
+		add_path(baserel, 
+			(Path *) create_foreignscan_path(root, baserel, baserel->rows, startup_cost,
+				total_cost * DEFAULT_SORT_MULTIPLIER, root->query_pathkeys, NULL, NIL));
+	}
+	
+	/*
+	 * The columns that are wider than the key can also be fetched by key, which
+	 * is cheaper when the local conditions throw away enough rows.
+	 */
+	if (list_length(late_attrs) > list_length(lazy_attrs))
+	{
+		#ifdef DEBUG
+			ereport(NOTICE,
+				(errmsg("Adding path that fetches wide columns by key")
+				));
+		#endif
+		
+		add_path(baserel, 
+			(Path *) create_foreignscan_path(root, baserel, baserel->rows, startup_cost,
+				eager_cost + tdsGetLazyFetchCost(root, baserel, fpinfo, late_attrs), NIL, NULL,
+				list_make1(makeInteger(true))));
+	}
+	
+	if (fpinfo->pushdown)
+	{
+		tdsAddParameterizedPaths(root, baserel, startup_cost);
+	}
+	
+	#ifdef DEBUG
+		ereport(NOTICE,
+			(errmsg("----> finishing tdsGetForeignPaths")
+			));
+	#endif
+}
+
+static bool tdsAnalyzeForeignTable(Relation relation, AcquireSampleRowsFunc *func, BlockNumber *totalpages)
+{
+	#ifdef DEBUG
+		ereport(NOTICE,
+			(errmsg("----> starting tdsAnalyzeForeignTable")
+			));
+	#endif
+	
+	#ifdef DEBUG
+		ereport(NOTICE,
+			(errmsg("----> finishing tdsAnalyzeForeignTable")
+			));
+	#endif
+	
+	return false;
+}
+
+static ForeignScan* tdsGetForeignPlan(PlannerInfo *root, RelOptInfo *baserel, 
+	Oid foreigntableid, ForeignPath *best_path, List *tlist, List *scan_clauses)
+{
+	TdsFdwRelationInfo *fpinfo = (TdsFdwRelationInfo *) baserel->fdw_private;
+	Index scan_relid = baserel->relid;
+	List *local_exprs = NIL;
+	List *remote_exprs = NIL;
+	List *retrieved_attrs = NIL;
+	List *sort_items = NIL;
+	List *placeholder_names = NIL;
+	List *placeholder_exprs = NIL;
+	List *remote_params;
+	List *staged_params = NIL;
+	List *lazy_attrs = NIL;
+	List *fdw_private;
+	int limit = 0;
+	int fast_rows = 0;
+	int nlazy_quals = 0;
+	ListCell *lc;
+	
+	#ifdef DEBUG
+		ereport(NOTICE,
+			(errmsg("----> starting tdsGetForeignPlan")
+			));
+	#endif
+	
+	if (fpinfo->option_set.nplaceholders > 0)
+	{
+		tdsGetPlaceholderExprs(baserel, &fpinfo->option_set, scan_clauses,
+			&placeholder_names, &placeholder_exprs);
+	}
+	
+	if (!fpinfo->pushdown)
+	{
+		local_exprs = extract_actual_clauses(scan_clauses, false);
+	}
+	
+	else
+	{
+		foreach (lc, scan_clauses)
+		{
+			RestrictInfo *rinfo = (RestrictInfo *) lfirst(lc);
+			bool is_remote = list_member_ptr(fpinfo->remote_conds, rinfo);
+			bool is_local = list_member_ptr(fpinfo->local_conds, rinfo);
+			
+			/* these are handled elsewhere */
+			if (rinfo->pseudoconstant)
+				continue;
+			
+			if (!is_remote && !is_local)
+			{
+				bool recheck = false;
+				
+				is_remote = tdsIsForeignExpr(baserel, rinfo->clause, &recheck);
+				is_local = !is_remote || recheck;
+			}
+			
+			if (is_remote)
+				remote_exprs = lappend(remote_exprs, rinfo->clause);
+			
+			if (is_local)
+				local_exprs = lappend(local_exprs, rinfo->clause);
+		}
+		
+		retrieved_attrs = tdsGetRetrievedAttrs(fpinfo);
+		sort_items = tdsGetSortItems(baserel, best_path->path.pathkeys);
+		limit = tdsGetRemoteLimit(root, baserel, fpinfo, &best_path->path);
+		fast_rows = tdsGetFastRows(root, baserel, limit);
+	}
+	
+	/*
+	 * Parameters used by remote conditions are computed when the scan starts,
+	 * after the placeholders. Columns of other relations are replaced with
+	 * parameters by the planner.
+	 */
+	remote_params = tdsGetRemoteParams(remote_exprs, baserel->relid);
+	placeholder_exprs = list_concat(placeholder_exprs, copyObject(remote_params));
+	
+	if (fpinfo->option_set.staging_threshold > 0)
+	{
+		staged_params = tdsGetStagedParams(root, remote_params, fpinfo->option_set.staging_threshold);
+	}
+	
+	if (fpinfo->pushdown)
+	{
+		/* the path of a late fetch is marked in its fdw_private */
+		lazy_attrs = tdsGetLazyAttrs(root, baserel, fpinfo, retrieved_attrs, local_exprs, best_path->fdw_private != NIL);
+	}
+	
+	/*
+	 * The query leaves out the lazy columns but has the key, to look them up
+	 * with. The local conditions are checked by the scan, after the parameters
+	 * in fdw_exprs, so that the lookups are only for rows that pass them.
+	 */
+	if (lazy_attrs != NIL)
+	{
+		List *query_attrs = NIL;
+		int attnum;
+		
+		for (attnum = 1; attnum <= fpinfo->option_set.ncolumns; attnum++)
+		{
+			if ((list_member_int(retrieved_attrs, attnum) || attnum == fpinfo->option_set.key_attnum) &&
+				!list_member_int(lazy_attrs, attnum))
+			{
+				query_attrs = lappend_int(query_attrs, attnum);
+			}
+		}
+		
+		retrieved_attrs = query_attrs;
+		nlazy_quals = list_length(local_exprs);
+		placeholder_exprs = list_concat(placeholder_exprs, local_exprs);
+		local_exprs = NIL;
+	}
+	
+	fdw_private = list_make4(makeInteger(fpinfo->pushdown), retrieved_attrs, remote_exprs, sort_items);
+	fdw_private = lappend(fdw_private, makeInteger(limit));
+	fdw_private = lappend(fdw_private, placeholder_names);
+	fdw_private = lappend(fdw_private, makeInteger(baserel->relid));
+	fdw_private = lappend(fdw_private, staged_params);
+	fdw_private = lappend(fdw_private, makeInteger(fast_rows));
+	fdw_private = lappend(fdw_private, lazy_attrs);
+	fdw_private = lappend(fdw_private, makeInteger(nlazy_quals));
+	
+	#ifdef DEBUG
+		ereport(NOTICE,
+			(errmsg("----> finishing tdsGetForeignPlan")
+			));
+	#endif
+	
+	return make_foreignscan(tlist, local_exprs, scan_relid, placeholder_exprs, fdw_private);
+}
+
+/*
+ * Choose the array parameters whose values are copied to a temporary table on
+ * the foreign server, so that the foreign table is joined with them there. This
+ * costs a bulk copy each time the scan starts, so it is only done when the array
+ * is expected to have at least staging_threshold values. The parameters are
+ * numbered from 1.
+ */
+
+static List* tdsGetStagedParams(PlannerInfo *root, List *remote_params, int staging_threshold)
+{
+	List *staged_params = NIL;
+	ListCell *lc;
+	int index = 1;
+	
+	foreach (lc, remote_params)
+	{
+		Node *node = (Node *) lfirst(lc);
+		
+		if (get_element_type(exprType(node)) != InvalidOid &&
+			tdsEstimateArrayLength(root, node) >= staging_threshold)
+		{
+			staged_params = lappend_int(staged_params, index);
+			
+			#ifdef DEBUG
+				ereport(NOTICE,
+					(errmsg("Values of parameter %i will be copied to the foreign server", index)
+					));
+			#endif
+		}
+		
+		index++;
+	}
+	
+	return staged_params;
+}
+
+/*
+ * Estimate the number of values in an array parameter. An array that is
+ * computed by a subquery, e.g. ARRAY(SELECT ...), has the rows of its plan.
+ */
+
+static double tdsEstimateArrayLength(PlannerInfo *root, Node *node)
+{
+	ListCell *lc;
+	
+	if (IsA(node, Param) && ((Param *) node)->paramkind == PARAM_EXEC)
+	{
+		foreach (lc, root->init_plans)
+		{
+			SubPlan *subplan = (SubPlan *) lfirst(lc);
+			
+			if (list_member_int(subplan->setParam, ((Param *) node)->paramid))
+				return planner_subplan_get_plan(root, subplan)->plan_rows;
+		}
+	}
+	
+	/* the same guess as the planner makes for arrays it can't see */
+	return 10;
+}
+
+/*
+ * Find the conditions that give values to the placeholders of the query, such
+ * as ts >= now() for a column with placeholder_from. The values are computed
+ * when the scan starts, so the expressions are kept in fdw_exprs. Placeholders
+ * only narrow down the rows that the query returns, so every condition is
+ * still checked as usual.
+ */
+
+static void tdsGetPlaceholderExprs(RelOptInfo *baserel, TdsFdwOptionSet *option_set, List *scan_clauses,
+	List **placeholder_names, List **placeholder_exprs)
+{
+	ListCell *lc;
+	
+	foreach (lc, scan_clauses)
+	{
+		RestrictInfo *rinfo = (RestrictInfo *) lfirst(lc);
+		OpExpr *op = (OpExpr *) rinfo->clause;
+		Node *left;
+		Node *right;
+		Var *var;
+		Expr *value;
+		TdsFdwColumnOption *column;
+		char *opname;
+		bool commuted;
+		bool is_equal, is_lower, is_upper;
+		
+		if (!IsA(op, OpExpr) || list_length(op->args) != 2 || op->opno >= FirstBootstrapObjectId)
+			continue;
+		
+		left = (Node *) linitial(op->args);
+		right = (Node *) lsecond(op->args);
+		
+		while (IsA(left, RelabelType))
+			left = (Node *) ((RelabelType *) left)->arg;
+		
+		while (IsA(right, RelabelType))
+			right = (Node *) ((RelabelType *) right)->arg;
+		
+		if (IsA(left, Var) && !contain_var_clause(right))
+		{
+			var = (Var *) left;
+			value = (Expr *) lsecond(op->args);
+			commuted = false;
+		}
+		
+		else if (IsA(right, Var) && !contain_var_clause(left))
+		{
+			var = (Var *) right;
+			value = (Expr *) linitial(op->args);
+			commuted = true;
+		}
+		
+		else
+		{
+			continue;
+		}
+		
+		if (var->varno != baserel->relid || var->varlevelsup != 0 ||
+			var->varattno <= 0 || var->varattno > option_set->ncolumns)
+			continue;
+		
+		column = &option_set->columns[var->varattno - 1];
+		
+		if (!column->placeholder && !column->placeholder_from && !column->placeholder_to)
+			continue;
+		
+		if (contain_volatile_functions((Node *) value) || contain_subplans((Node *) value))
+			continue;
+		
+		if (!tdsIsPlaceholderType(var->vartype, exprType((Node *) value)))
+			continue;
+		
+		if ((opname = get_opname(op->opno)) == NULL)
+			continue;
+		
+		is_equal = (strcmp(opname, "=") == 0);
+		is_lower = (strcmp(opname, commuted ? "<" : ">") == 0 || strcmp(opname, commuted ? "<=" : ">=") == 0);
+		is_upper = (strcmp(opname, commuted ? ">" : "<") == 0 || strcmp(opname, commuted ? ">=" : "<=") == 0);
+		
+		pfree(opname);
+		
+		/* text may be sorted differently on the foreign server */
+		if (tdsIsTextType(var->vartype) && !is_equal)
+			continue;
+		
+		if (is_equal && column->placeholder)
+		{
+			*placeholder_names = lappend(*placeholder_names, makeString(column->placeholder));
+			*placeholder_exprs = lappend(*placeholder_exprs, value);
+		}
+		
+		if ((is_equal || is_lower) && column->placeholder_from)
+		{
+			*placeholder_names = lappend(*placeholder_names, makeString(column->placeholder_from));
+			*placeholder_exprs = lappend(*placeholder_exprs, value);
+		}
+		
+		if ((is_equal || is_upper) && column->placeholder_to)
+		{
+			*placeholder_names = lappend(*placeholder_names, makeString(column->placeholder_to));
+			*placeholder_exprs = lappend(*placeholder_exprs, value);
+		}
+	}
+}
+
+/*
+ * Add paths that look up the rows that match each row of other relations, e.g.
+ * as the inner side of a nested loop, so that the whole foreign table doesn't
+ * have to be read. The values of the other relations' columns are sent as
+ * parameters, and the query is prepared when it is run again.
+ */
+
+static void tdsAddParameterizedPaths(PlannerInfo *root, RelOptInfo *baserel, Cost startup_cost)
+{
+	List *clauses = NIL;
+	List *required_outers = NIL;
+	ListCell *lc;
+	
+	/* join conditions that could be checked by this scan */
+	foreach (lc, baserel->joininfo)
+	{
+		RestrictInfo *rinfo = (RestrictInfo *) lfirst(lc);
+		
+		if (join_clause_is_movable_to(rinfo, baserel->relid))
+			clauses = lappend(clauses, rinfo);
+	}
+	
+	/* equality conditions that are implied by equivalence classes, e.g. a.x = b.y */
+	#if (PG_VERSION_NUM >= 90300)
+	if (baserel->has_eclass_joins)
+	{
+		TdsEcMemberContext context;
+		
+		context.already_used = NIL;
+		
+		for (;;)
+		{
+			List *ec_clauses;
+			
+			context.current = NULL;
+			
+			ec_clauses = generate_implied_equalities_for_column(root, baserel,
+				tdsEcMemberMatches, (void *) &context, baserel->lateral_referencers);
+			
+			if (context.current == NULL)
 				break;
 			
-			default:
-				ereport(ERROR,
-					(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
-					errmsg("Failed to get row during query. Unknown return code.")
-					));
+			clauses = list_concat(clauses, ec_clauses);
+			context.already_used = lappend(context.already_used, context.current);
 		}
 	}
+	#endif
 	
-	else
+	foreach (lc, clauses)
 	{
-		ereport(NOTICE,
-			(errmsg("No more rows")
-			));
+		RestrictInfo *rinfo = (RestrictInfo *) lfirst(lc);
+		Relids required_outer;
+		bool recheck = false;
+		ListCell *lc_outer;
+		bool found = false;
+		
+		if (!tdsIsForeignExpr(baserel, rinfo->clause, &recheck))
+			continue;
+		
+		required_outer = bms_del_member(bms_copy(rinfo->clause_relids), baserel->relid);
+		
+		if (bms_is_empty(required_outer))
+			continue;
+		
+		foreach (lc_outer, required_outers)
+		{
+			if (bms_equal((Relids) lfirst(lc_outer), required_outer))
+				found = true;
+		}
+		
+		if (!found)
+			required_outers = lappend(required_outers, required_outer);
 	}
 	
-	#ifdef DEBUG
-		ereport(NOTICE,
-			(errmsg("----> finishing tdsIterateForeignScan")
-			));
-	#endif
-
-	return slot;
+	foreach (lc, required_outers)
+	{
+		Relids required_outer = (Relids) lfirst(lc);
+		ParamPathInfo *param_info = get_baserel_parampathinfo(root, baserel, required_outer);
+		
+		#ifdef DEBUG
+			ereport(NOTICE,
+				(errmsg("Adding parameterized path with %.0f rows", param_info->ppi_rows)
+				));
+		#endif
+		
+		/* every lookup is a round trip, so it costs as much to start as a scan */
+		add_path(baserel, 
+			(Path *) create_foreignscan_path(root, baserel, param_info->ppi_rows, startup_cost,
+				startup_cost + param_info->ppi_rows, NIL, required_outer, NIL));
+	}
 }
 
-/* rescan foreign table */
+#if (PG_VERSION_NUM >= 90300)
 
-static void tdsReScanForeignScan(ForeignScanState *node)
+/* find the equivalence class members of the foreign table, one at a time */
+
+static bool tdsEcMemberMatches(PlannerInfo *root, RelOptInfo *rel, EquivalenceClass *ec,
+	EquivalenceMember *em, void *arg)
 {
-	#ifdef DEBUG
-		ereport(NOTICE,
-			(errmsg("----> starting tdsReScanForeignScan")
-			));
-	#endif
+	TdsEcMemberContext *context = (TdsEcMemberContext *) arg;
+	Expr *expr = em->em_expr;
 	
-	#ifdef DEBUG
-		ereport(NOTICE,
-			(errmsg("----> finishing tdsReScanForeignScan")
-			));
-	#endif
+	if (context->current != NULL)
+		return equal(expr, context->current);
+	
+	if (list_member(context->already_used, expr))
+		return false;
+	
+	context->current = expr;
+	
+	return true;
 }
 
-/* cleanup objects related to scan */
+#endif
 
-static void tdsEndForeignScan(ForeignScanState *node)
+/* get the columns that have to be retrieved from the foreign server */
+
+static List* tdsGetRetrievedAttrs(TdsFdwRelationInfo *fpinfo)
 {
-	TdsFdwExecutionState *festate = (TdsFdwExecutionState *) node->fdw_state;
-	
-	#ifdef DEBUG
-		ereport(NOTICE,
-			(errmsg("----> starting tdsEndForeignScan")
-			));
-	#endif
+	List *retrieved_attrs = NIL;
+	bool whole_row = bms_is_member(0 - FirstLowInvalidHeapAttributeNumber, fpinfo->attrs_used);
+	int attnum;
 	
-	if (festate->query)
+	for (attnum = 1; attnum <= fpinfo->option_set.ncolumns; attnum++)
 	{
-		pfree(festate->query);
+		if (whole_row || bms_is_member(attnum - FirstLowInvalidHeapAttributeNumber, fpinfo->attrs_used))
+			retrieved_attrs = lappend_int(retrieved_attrs, attnum);
 	}
 	
-	#ifdef DEBUG
-		ereport(NOTICE,
-			(errmsg("Closing database connection")
-			));
-	#endif
+	return retrieved_attrs;
+}
+
+/*
+ * get the retrieved columns that are fetched by key after the local conditions
+ * have been checked. That only saves anything when some rows are thrown away
+ * locally, and the columns used by the conditions are needed before then. The
+ * lookups can't give values to placeholders, so those queries are left alone.
+ * With late_fetch, the columns that are wider than the key are also fetched
+ * that way, besides the lazy columns.
+ */
+
+static List* tdsGetLazyAttrs(PlannerInfo *root, RelOptInfo *baserel, TdsFdwRelationInfo *fpinfo, List *retrieved_attrs,
+	List *local_exprs, bool late_fetch)
+{
+	List *lazy_attrs = NIL;
+	Bitmapset *qual_attrs = NULL;
+	ListCell *lc;
+	int key_attnum = fpinfo->option_set.key_attnum;
+	int32 key_width;
 	
-	dbclose(festate->dbproc);
+	if (key_attnum == 0 || fpinfo->option_set.nplaceholders > 0 || local_exprs == NIL)
+		return NIL;
 	
-	#ifdef DEBUG
-		ereport(NOTICE,
-			(errmsg("Freeing login structure")
-			));
-	#endif	
+	pull_varattnos((Node *) local_exprs, baserel->relid, &qual_attrs);
 	
-	dbloginfree(festate->login);
+	/* a whole-row reference uses every column */
+	if (bms_is_member(0 - FirstLowInvalidHeapAttributeNumber, qual_attrs))
+		return NIL;
 	
-	#ifdef DEBUG
-		ereport(NOTICE,
-			(errmsg("Closing DB-Library")
-			));
-	#endif
+	key_width = tdsGetAttrWidth(root, baserel, key_attnum);
 	
-	dbexit();
+	foreach (lc, retrieved_attrs)
+	{
+		int attnum = lfirst_int(lc);
+		
+		if (attnum == key_attnum || bms_is_member(attnum - FirstLowInvalidHeapAttributeNumber, qual_attrs))
+			continue;
+		
+		if (fpinfo->option_set.columns[attnum - 1].lazy ||
+			(late_fetch && tdsGetAttrWidth(root, baserel, attnum) > key_width))
+		{
+			lazy_attrs = lappend_int(lazy_attrs, attnum);
+		}
+	}
 	
-	#ifdef DEBUG
-		ereport(NOTICE,
-			(errmsg("----> finishing tdsEndForeignScan")
-			));
-	#endif
+	return lazy_attrs;
 }
 
-/* routines for 9.2.0+ */
-#if (PG_VERSION_NUM >= 90200)
+/* get the average width of a column, from ANALYZE if it has been run */
 
-static void tdsGetForeignRelSize(PlannerInfo *root, RelOptInfo *baserel, Oid foreigntableid)
+static int32 tdsGetAttrWidth(PlannerInfo *root, RelOptInfo *baserel, int attnum)
 {
-	TdsFdwOptionSet option_set;
-	LOGINREC *login;
-	DBPROCESS *dbproc;
+	int32 width = 0;
 	
-	#ifdef DEBUG
-		ereport(NOTICE,
-			(errmsg("----> starting tdsGetForeignRelSize")
-			));
-	#endif
+	if (attnum >= baserel->min_attr && attnum <= baserel->max_attr)
+		width = baserel->attr_widths[attnum - baserel->min_attr];
 	
-	tdsGetOptions(foreigntableid, &option_set);
-		
-	#ifdef DEBUG
-		ereport(NOTICE,
-			(errmsg("Initiating DB-Library")
-			));
-	#endif
+	if (width <= 0)
+		width = get_attavgwidth(planner_rt_fetch(baserel->relid, root)->relid, attnum);
 	
-	if (dbinit() == FAIL)
+	if (width <= 0)
+		width = DEFAULT_COLUMN_WIDTH;
+	
+	return width;
+}
+
+/*
+ * How much more a scan costs when it fetches some columns by key, after the
+ * local conditions, than when it fetches them with every row. This is less
+ * than nothing when enough rows are thrown away. Their columns are not
+ * transferred, but the keys are sent back, each batch of rows takes another
+ * lookup, and the lookups need a second connection.
+ */
+
+static Cost tdsGetLazyFetchCost(PlannerInfo *root, RelOptInfo *baserel, TdsFdwRelationInfo *fpinfo, List *lazy_attrs)
+{
+	Selectivity selectivity = clauselist_selectivity(root, fpinfo->local_conds, baserel->relid, JOIN_INNER, NULL);
+	double key_width = tdsGetAttrWidth(root, baserel, fpinfo->option_set.key_attnum);
+	double lazy_width = 0;
+	double rows_fetched;
+	double rows_returned;
+	double saved_bytes;
+	double lookup_bytes;
+	ListCell *lc;
+	
+	foreach (lc, lazy_attrs)
 	{
-		ereport(ERROR,
-			(errcode(ERRCODE_FDW_OUT_OF_MEMORY),
-				errmsg("Failed to initialize DB-Library environment")
-			));
-		goto cleanup_before_init;
+		lazy_width += tdsGetAttrWidth(root, baserel, lfirst_int(lc));
 	}
 	
-	dberrhandle(tds_err_handler);
-	dbmsghandle(tds_msg_handler);
+	rows_returned = baserel->rows;
+	rows_fetched = (selectivity > 0 && selectivity < 1) ? clamp_row_est(rows_returned / selectivity) : rows_returned;
+	
+	saved_bytes = (rows_fetched - rows_returned) * lazy_width;
+	lookup_bytes = rows_returned * key_width * 2 +
+		ceil(rows_fetched / fpinfo->option_set.fetch_size) * LAZY_LOOKUP_BYTES;
 	
 	#ifdef DEBUG
 		ereport(NOTICE,
-			(errmsg("Getting login structure")
+			(errmsg("Fetching %i columns later saves %.0f bytes and costs %.0f", list_length(lazy_attrs),
+				saved_bytes, lookup_bytes)
 			));
 	#endif
 	
-	if ((login = dblogin()) == NULL)
-	{
-		ereport(ERROR,
-			(errcode(ERRCODE_FDW_OUT_OF_MEMORY),
-				errmsg("Failed to initialize DB-Library login structure")
-			));
-		goto cleanup_before_login;
-	}
+	return tdsGetStartupCost(&fpinfo->option_set) + (lookup_bytes - saved_bytes) * TRANSFER_BYTE_COST;
+}
+
+/* get the ORDER BY items for the pathkeys, or NIL if the foreign server can't sort by them */
+
+static List* tdsGetSortItems(RelOptInfo *baserel, List *pathkeys)
+{
+	List *sort_items = NIL;
+	ListCell *lc;
 	
-	if (tdsSetupConnection(&option_set, login, &dbproc) != 0)
+	foreach (lc, pathkeys)
 	{
-		goto cleanup;
-	}
+		PathKey *pathkey = (PathKey *) lfirst(lc);
+		EquivalenceClass *ec = pathkey->pk_eclass;
+		Var *var = NULL;
+		ListCell *lc_em;
 		
-	baserel->rows = tdsGetRowCount(&option_set, login, dbproc);
-	baserel->tuples = baserel->rows;
-	
-cleanup:
-	dbclose(dbproc);
-	dbloginfree(login);
+		/* only built-in sort orders, which match the ones on the foreign server */
+		if (ec->ec_has_volatile || pathkey->pk_opfamily >= FirstBootstrapObjectId)
+			return NIL;
 		
-cleanup_before_login:
-	dbexit();
-	
-cleanup_before_init:
-	;
+		foreach (lc_em, ec->ec_members)
+		{
+			EquivalenceMember *em = (EquivalenceMember *) lfirst(lc_em);
+			Var *em_var = (Var *) em->em_expr;
+			
+			if (!bms_equal(em->em_relids, baserel->relids) || !IsA(em_var, Var))
+				continue;
+			
+			/* text is sorted by the collation of the foreign server, which may differ */
+			if (em_var->varno == baserel->relid && em_var->varattno > 0 &&
+				tdsIsPushableType(em_var->vartype) && !tdsIsTextType(em_var->vartype))
+			{
+				var = em_var;
+				break;
+			}
+		}
+		
+		if (!var)
+			return NIL;
+		
+		sort_items = lappend(sort_items, list_make3(var,
+			makeInteger(pathkey->pk_strategy == BTGreaterStrategyNumber),
+			makeInteger(pathkey->pk_nulls_first)));
+	}
 	
-	#ifdef DEBUG
-		ereport(NOTICE,
-			(errmsg("----> finishing tdsGetForeignRelSize")
-			));
-	#endif	
+	return sort_items;
 }
 
-static void tdsEstimateCosts(PlannerInfo *root, RelOptInfo *baserel, Cost *startup_cost, Cost *total_cost, Oid foreigntableid)
+/*
+ * Get the number of rows for TOP, or 0. This is only safe when the foreign
+ * table is the only relation in the query, and every condition and the
+ * ORDER BY are handled by the foreign server.
+ */
+
+static int tdsGetRemoteLimit(PlannerInfo *root, RelOptInfo *baserel, TdsFdwRelationInfo *fpinfo, Path *path)
 {
-	TdsFdwOptionSet option_set;
-	
-	#ifdef DEBUG
-		ereport(NOTICE,
-			(errmsg("----> starting tdsEstimateCosts")
-			));
-	#endif
+	Query *parse = root->parse;
+	RangeTblRef *rtr;
 	
-	tdsGetOptions(foreigntableid, &option_set);	
+	if (fpinfo->local_conds != NIL)
+		return 0;
 	
-	*startup_cost = tdsGetStartupCost(&option_set);
-		
-	*total_cost = baserel->rows + *startup_cost;
+	if (root->limit_tuples < 1 || root->limit_tuples > INT_MAX)
+		return 0;
 	
-	#ifdef DEBUG
-		ereport(NOTICE,
-			(errmsg("----> finishing tdsEstimateCosts")
-			));
-	#endif
-}
-
-static void tdsGetForeignPaths(PlannerInfo *root, RelOptInfo *baserel, Oid foreigntableid)
-{
-	Cost startup_cost;
-	Cost total_cost;
+	if (parse->groupClause || parse->hasAggs || parse->hasWindowFuncs ||
+		parse->distinctClause || parse->havingQual || parse->setOperations)
+		return 0;
 	
-	#ifdef DEBUG
-		ereport(NOTICE,
-			(errmsg("----> starting tdsGetForeignPaths")
-			));
-	#endif
+	if (expression_returns_set((Node *) parse->targetList))
+		return 0;
 	
-	tdsEstimateCosts(root, baserel, &startup_cost, &total_cost, foreigntableid);
+	if (list_length(parse->jointree->fromlist) != 1 || !IsA(linitial(parse->jointree->fromlist), RangeTblRef))
+		return 0;
 	
-	add_path(baserel, 
-		(Path *) create_foreignscan_path(root, baserel, baserel->rows, startup_cost, total_cost,
-			NIL, NULL, NIL));
+	rtr = (RangeTblRef *) linitial(parse->jointree->fromlist);
 	
-	#ifdef DEBUG
-		ereport(NOTICE,
-			(errmsg("----> finishing tdsGetForeignPaths")
-			));
-	#endif
-}
-
-static bool tdsAnalyzeForeignTable(Relation relation, AcquireSampleRowsFunc *func, BlockNumber *totalpages)
-{
-	#ifdef DEBUG
-		ereport(NOTICE,
-			(errmsg("----> starting tdsAnalyzeForeignTable")
-			));
-	#endif
+	if (rtr->rtindex != baserel->relid)
+		return 0;
 	
-	#ifdef DEBUG
-		ereport(NOTICE,
-			(errmsg("----> finishing tdsAnalyzeForeignTable")
-			));
-	#endif
+	if (root->query_pathkeys != NIL && !pathkeys_contained_in(root->query_pathkeys, path->pathkeys))
+		return 0;
 	
-	return false;
+	return (int) root->limit_tuples;
 }
 
-static ForeignScan* tdsGetForeignPlan(PlannerInfo *root, RelOptInfo *baserel, 
-	Oid foreigntableid, ForeignPath *best_path, List *tlist, List *scan_clauses)
+/*
+ * Get the number of rows for OPTION (FAST n), when only the first rows of the
+ * scan are likely to be fetched, e.g. by a cursor, EXISTS or a LIMIT that can't
+ * be sent as TOP. Otherwise the foreign server optimizes for all of the rows.
+ */
+
+static int tdsGetFastRows(PlannerInfo *root, RelOptInfo *baserel, int limit)
 {
-	Index scan_relid = baserel->relid;
-	#ifdef DEBUG
-		ereport(NOTICE,
-			(errmsg("----> starting tdsGetForeignPlan")
-			));
-	#endif
+	double rows;
 	
-	scan_clauses = extract_actual_clauses(scan_clauses, false);
+	if (limit > 0 || root->tuple_fraction <= 0)
+		return 0;
 	
-	#ifdef DEBUG
-		ereport(NOTICE,
-			(errmsg("----> finishing tdsGetForeignPlan")
-			));
-	#endif
+	/* a fraction of the rows, or an absolute number of them */
+	if (root->tuple_fraction < 1.0)
+		rows = clamp_row_est(root->tuple_fraction * baserel->rows);
+	else
+		rows = clamp_row_est(root->tuple_fraction);
+	
+	if (rows >= baserel->rows || rows > INT_MAX)
+		return 0;
 	
-	return make_foreignscan(tlist, scan_clauses, scan_relid, NIL, NIL);
+	return (int) rows;
 }
 
 /* routines for versions older than 9.2.0 */
@@ -1633,8 +5778,10 @@ static FdwPlan* tdsPlanForeignScan(Oid foreigntableid, PlannerInfo *root, RelOpt
 {
 	FdwPlan *fdwplan;
 	TdsFdwOptionSet option_set;
+	TdsFdwRemoteScan remote_scan;
 	LOGINREC *login;
 	DBPROCESS *dbproc;
+	Relation rel;
 	
 	#ifdef DEBUG
 		ereport(NOTICE,
@@ -1685,6 +5832,12 @@ static FdwPlan* tdsPlanForeignScan(Oid foreigntableid, PlannerInfo *root, RelOpt
 	{
 		goto cleanup;
 	}
+	
+	tdsRemoteScanInit(&remote_scan);
+	
+	rel = heap_open(foreigntableid, NoLock);
+	option_set.query = tdsBuildQuery(rel, &option_set, &remote_scan);
+	heap_close(rel, NoLock);
 		
 	baserel->rows = tdsGetRowCount(&option_set, login, dbproc);
 	baserel->tuples = baserel->rows;
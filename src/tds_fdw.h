@@ -0,0 +1,282 @@
+/*------------------------------------------------------------------
+*
+*				Foreign data wrapper for TDS (Sybase and Microsoft SQL Server)
+*
+* Author: Geoff Montee
+* Name: tds_fdw
+* File: tds_fdw/src/tds_fdw.h
+*
+* Description:
+* This is a PostgreSQL foreign data wrapper for use to connect to databases that use TDS,
+* such as Sybase databases and Microsoft SQL server.
+*
+* This foreign data wrapper requires requires a library that uses the DB-Library interface,
+* such as FreeTDS (http://www.freetds.org/). This has been tested with FreeTDS, but not
+* the proprietary implementations of DB-Library.
+*----------------------------------------------------------------------------
+*/
+
+#ifndef TDS_FDW_H
+#define TDS_FDW_H
+
+#include "postgres.h"
+
+#include "funcapi.h"
+#include "lib/stringinfo.h"
+#include "nodes/relation.h"
+#include "portability/instr_time.h"
+#include "utils/rel.h"
+
+/* DB-Library headers (e.g. FreeTDS */
+#include <sybfront.h>
+#include <sybdb.h>
+
+/* nvarchar, which is needed for the arguments of sp_executesql */
+#ifndef XSYBNVARCHAR
+#define XSYBNVARCHAR 231
+#endif
+
+/* date and time types of SQL Server 2008 and later, which are returned with TDS 7.3 */
+#ifndef SYBMSDATE
+#define SYBMSDATE 40
+#endif
+
+#ifndef SYBMSTIME
+#define SYBMSTIME 41
+#endif
+
+#ifndef SYBMSDATETIME2
+#define SYBMSDATETIME2 42
+#endif
+
+#ifndef SYBMSDATETIMEOFFSET
+#define SYBMSDATETIMEOFFSET 43
+#endif
+
+/* the product of the foreign server */
+
+typedef enum TdsFdwProduct
+{
+	TDS_PRODUCT_UNKNOWN,
+	TDS_PRODUCT_SQLSERVER,
+	TDS_PRODUCT_SYBASE
+} TdsFdwProduct;
+
+/*
+ * what the foreign server is, which decides the SQL that it understands. A
+ * major_version of 0 means that the version is not known, and then the newest
+ * one is assumed.
+ */
+
+typedef struct TdsFdwDialect
+{
+	TdsFdwProduct product;
+	int major_version;
+	int tds_version;
+} TdsFdwDialect;
+
+/* options for a single column of a foreign table */
+
+typedef struct TdsFdwColumnOption
+{
+	char *column_name;
+	bool compress;
+	bool lazy;
+	char *placeholder;
+	char *placeholder_from;
+	char *placeholder_to;
+} TdsFdwColumnOption;
+
+/*
+ * a parameter of the remote query, and its value. This is either a placeholder
+ * in the query option, such as {{tenant_id}}, or a parameter of the local query
+ * that is used in a condition sent to the foreign server.
+ */
+
+typedef struct TdsFdwParameter
+{
+	char *name;
+	Oid typid;
+	bool isnull;
+	Datum value;
+	Oid valuetype;
+} TdsFdwParameter;
+
+/* option values will be put here */
+
+typedef struct TdsFdwOptionSet
+{
+	char *servername;
+	char *language;
+	char *character_set;
+	int port;
+	int packet_size;
+	char *username;
+	char *password;
+	char *database;
+	char *query;
+	char *table;
+	bool compress;
+	bool derived_table;
+	int staging_threshold;
+	int maxdop;
+	bool recompile;
+	char *table_hints;
+	char *isolation_level;
+	int fetch_size;
+	int text_size;
+	char *key_column;
+	int key_attnum;
+	int ncolumns;
+	TdsFdwColumnOption *columns;
+	int nplaceholders;
+	TdsFdwParameter *placeholders;
+	TdsFdwDialect dialect;
+} TdsFdwOptionSet;
+
+/* planner information about a foreign table, kept in baserel->fdw_private */
+
+typedef struct TdsFdwRelationInfo
+{
+	TdsFdwOptionSet option_set;
+	bool pushdown;
+	List *remote_conds;
+	List *local_conds;
+	Bitmapset *attrs_used;
+} TdsFdwRelationInfo;
+
+/* what is done by the foreign server for a scan */
+
+typedef struct TdsFdwRemoteScan
+{
+	bool pushdown;
+	List *retrieved_attrs;
+	List *remote_exprs;
+	List *sort_items;
+	int limit;
+	List *placeholder_names;
+	Index relid;
+	List *remote_params;
+	List *staged_params;
+	int fast_rows;
+	List *lazy_attrs;
+	int nlazy_quals;
+} TdsFdwRemoteScan;
+
+/* indexes of the items in ForeignScan->fdw_private */
+
+enum TdsFdwScanPrivateIndex
+{
+	TdsFdwScanPrivatePushdown,
+	TdsFdwScanPrivateRetrievedAttrs,
+	TdsFdwScanPrivateRemoteExprs,
+	TdsFdwScanPrivateSortItems,
+	TdsFdwScanPrivateLimit,
+	TdsFdwScanPrivatePlaceholderNames,
+	TdsFdwScanPrivateRelid,
+	TdsFdwScanPrivateStagedParams,
+	TdsFdwScanPrivateFastRows,
+	TdsFdwScanPrivateLazyAttrs,
+	TdsFdwScanPrivateLazyQuals
+};
+
+struct TdsFdwExecutionState;
+struct COL;
+
+/* turns a value of a column of the result into a local value */
+
+typedef Datum (*TdsFdwColumnDecoder)(struct TdsFdwExecutionState *festate, struct COL *column, BYTE *src, DBINT srclen,
+	bool *isnull);
+
+/*
+ * a column of the result, which is looked up once after dbresults(). attnum is
+ * the local column that it goes to, or 0 if it is ignored. buffer is reused for
+ * the values that are converted to text.
+ */
+
+typedef struct COL
+{
+	char *name;
+	char *buffer;
+	int buffer_size;
+	int type, size, status;
+	int attnum;
+	Oid typid;
+	TdsFdwColumnDecoder decoder;
+} COL;
+
+/* this maintains state */
+
+typedef struct TdsFdwExecutionState
+{
+	LOGINREC *login;
+	DBPROCESS *dbproc;
+	char *query;
+	int first;
+	COL *columns;
+	int ncols;
+	int row;
+	bool *compressed;
+	int *attnums;
+	int nattnums;
+	char **attnames;
+	AttInMetadata *attinmeta;
+	TdsFdwParameter *params;
+	int nparams;
+	int nplaceholders;
+	int nremote_params;
+	List *placeholder_names;
+	List *param_states;
+	List *staged_params;
+	TdsFdwDialect dialect;
+	bool verify_encoding;
+	MemoryContext scan_cxt;
+	MemoryContext batch_cxt;
+	int fetch_size;
+	int batch_rows;
+	int batch_nrows;
+	int batch_next;
+	bool batch_done;
+	Datum *batch_values;
+	bool *batch_nulls;
+	List *lazy_attrs;
+	List *lazy_quals;
+	List *lazy_qual_exprs;
+	int key_attnum;
+	DBPROCESS *lazy_dbproc;
+	char *lazy_query;
+	COL *lazy_columns;
+	int executions;
+	bool sent;
+	int ncancels;
+	instr_time cancel_time;
+	bool prepared;
+	DBINT prepared_handle;
+} TdsFdwExecutionState;
+
+/* Functions for generating remote SQL (deparse.c) */
+
+void tdsQuoteIdentifier(StringInfo buf, const char *ident);
+bool tdsIsCompressibleType(Oid typid);
+bool tdsIsPushableType(Oid typid);
+bool tdsIsTextType(Oid typid);
+bool tdsIsForeignExpr(RelOptInfo *baserel, Expr *expr, bool *recheck);
+bool tdsIsPushableValue(Datum value, Oid typid);
+bool tdsDialectHasTop(const TdsFdwDialect *dialect);
+bool tdsDialectHasCompress(const TdsFdwDialect *dialect);
+bool tdsDialectHasParameters(const TdsFdwDialect *dialect);
+const char* tdsGetParameterType(Oid typid, const TdsFdwDialect *dialect);
+bool tdsIsParameterValue(Datum value, Oid typid);
+char* tdsGetParameterString(Datum value, Oid typid);
+char* tdsGetParameterDeclarations(TdsFdwParameter *params, int nparams, const TdsFdwDialect *dialect);
+List* tdsGetRemoteParams(List *exprs, Index relid);
+bool tdsIsPlaceholderType(Oid column_type, Oid value_type);
+bool tdsIsPlaceholderName(const char *name);
+List* tdsGetPlaceholderNames(const char *query);
+const char* tdsGetColumnName(Relation rel, TdsFdwOptionSet* option_set, int attnum);
+char* tdsBuildQuery(Relation rel, TdsFdwOptionSet* option_set, TdsFdwRemoteScan* remote_scan);
+char* tdsBuildLazyQuery(Relation rel, TdsFdwOptionSet* option_set, List *lazy_attrs);
+void tdsAppendValue(StringInfo buf, Datum value, Oid typid);
+char* tdsBuildExecuteSql(const char *query, TdsFdwParameter *params, int nparams, const TdsFdwDialect *dialect);
+
+#endif